@@ -1,32 +1,214 @@
 #include "codegen.h"
 
 #include "compiler/parser/ast.h"
-
-#include "llvm/Pass.h"
+#include "compiler/passes/walk.h"
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
 
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/InlineCost.h"
+
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+
+#include "llvm/Target/TargetMachine.h"
+
+#include "llvm/Transforms/IPO/FunctionAttrs.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Inliner.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/IPO/MergeFunctions.h"
+#include "llvm/Transforms/IPO/SCCP.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Utils.h"
-
+#include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <utility>
 
 
 namespace mk
 {
+namespace
+{
+// Cleans up a function with mem2reg, unless promote is false, instcombine,
+// reassociate, GVN and simplifycfg
+llvm::FunctionPassManager cleanup(bool promote)
+{
+    llvm::FunctionPassManager passes;
+    // Promote allocas to registers, unless SSA form is built directly.
+    if (promote)
+        passes.addPass(llvm::PromotePass());
+    // Do simple "peephole" optimizations and bit-twiddling optzns.
+    passes.addPass(llvm::InstCombinePass());
+    // Reassociate expressions.
+    passes.addPass(llvm::ReassociatePass());
+    // Eliminate Common SubExpressions.
+    passes.addPass(llvm::GVNPass());
+    // Simplify the control flow graph (deleting unreachable blocks, etc).
+    passes.addPass(llvm::SimplifyCFGPass());
+    return passes;
+}
+
+llvm::FastMathFlags flags(ast::FastMath math)
+{
+    llvm::FastMathFlags flags;
+    flags.setAllowReassoc(math & ast::FastMath::reassoc);
+    flags.setAllowContract(math & ast::FastMath::contract);
+    flags.setNoNaNs(math & ast::FastMath::nnan);
+    flags.setNoInfs(math & ast::FastMath::ninf);
+    flags.setNoSignedZeros(math & ast::FastMath::nsz);
+    flags.setAllowReciprocal(math & ast::FastMath::arcp);
+    flags.setApproxFunc(math & ast::FastMath::afn);
+    return flags;
+}
+
+// The backend takes the options of each function from these attributes, as
+// clang sets them
+void attributes(llvm::Function & function, ast::FastMath math)
+{
+    const auto set = [&](const char * name, bool value)
+    {
+        if (value)
+            function.addFnAttr(name, "true");
+    };
+    set("unsafe-fp-math", math == ast::FastMath::fast);
+    set("no-nans-fp-math", math & ast::FastMath::nnan);
+    set("no-infs-fp-math", math & ast::FastMath::ninf);
+    set("no-signed-zeros-fp-math", math & ast::FastMath::nsz);
+    set("approx-func-fp-math", math & ast::FastMath::afn);
+}
+
+// Doubles hold every integer up to 2^53 exactly. Counted loops start and stop
+// within half of that, so that their variable stays exact even one step past
+// the bound.
+constexpr double exact = 0x1p52;
+
+// Value of a literal that is an integer within [min, max]
+std::optional<std::int64_t>
+integral(const ast::Expr * expr, double min, double max)
+{
+    if (!expr || expr->kind != ast::Kind::Literal)
+        return std::nullopt;
+    const auto value = static_cast<const ast::Literal *>(expr)->value;
+    if (!(value >= min && value <= max) || value != std::trunc(value))
+        return std::nullopt;
+    return static_cast<std::int64_t>(value);
+}
+
+// Slot of the variable expr, unresolved for other expressions
+std::uint32_t slot_of(const ast::Expr * expr)
+{
+    return expr && expr->kind == ast::Kind::Variable
+               ? static_cast<const ast::Variable *>(expr)->slot
+               : ast::unresolved;
+}
+
+CodeGen::Size size(const llvm::Module & module)
+{
+    CodeGen::Size size;
+    for (const auto & function : module)
+    {
+        if (function.isDeclaration())
+            continue;
+        ++size.functions;
+        size.instructions += function.getInstructionCount();
+    }
+    return size;
+}
+}  // namespace
+
+struct CodeGen::Pipeline
+{
+    Pipeline(const Options & options)
+        : builder(options.target)
+    {
+        builder.registerModuleAnalyses(modules);
+        builder.registerCGSCCAnalyses(cgscc);
+        builder.registerFunctionAnalyses(functions);
+        builder.registerLoopAnalyses(loops);
+        builder.crossRegisterProxies(loops, functions, cgscc, modules);
+
+        const auto promote = !options.ssa;
+        switch (options.level)
+        {
+        case OptLevel::O0:
+            break;
+        case OptLevel::O1:
+            function = cleanup(promote);
+            break;
+        case OptLevel::O2:
+            module = builder.buildPerModuleDefaultPipeline(
+                llvm::OptimizationLevel::O2);
+            break;
+        case OptLevel::O3:
+            module = builder.buildPerModuleDefaultPipeline(
+                llvm::OptimizationLevel::O3);
+            break;
+        case OptLevel::Os:
+            module = builder.buildPerModuleDefaultPipeline(
+                llvm::OptimizationLevel::Os);
+            break;
+        case OptLevel::Oz:
+            module = builder.buildPerModuleDefaultPipeline(
+                llvm::OptimizationLevel::Oz);
+            break;
+        }
+
+        if (options.ipo)
+            ipo(*options.ipo, promote);
+    }
+
+    void ipo(const IPO & ipo, bool promote)
+    {
+        if (ipo.internalize)
+            module.addPass(llvm::InternalizePass(
+                [](const llvm::GlobalValue & value)
+                { return value.getName() == "main"; }));
+        module.addPass(llvm::IPSCCPPass());
+
+        // Callees are inlined into their callers before these are, each
+        // caller is cleaned up once its calls are inlined
+        llvm::ModuleInlinerWrapperPass inliner(
+            llvm::getInlineParams(ipo.threshold));
+        inliner.getPM().addPass(llvm::PostOrderFunctionAttrsPass());
+        inliner.getPM().addPass(
+            llvm::createCGSCCToFunctionPassAdaptor(cleanup(promote)));
+        module.addPass(std::move(inliner));
+
+        module.addPass(llvm::GlobalDCEPass());
+        module.addPass(llvm::MergeFunctionsPass());
+    }
+
+    // Outlives the analyses it registers, they refer to it
+    llvm::PassBuilder builder;
+    llvm::LoopAnalysisManager loops;
+    llvm::FunctionAnalysisManager functions;
+    llvm::CGSCCAnalysisManager cgscc;
+    llvm::ModuleAnalysisManager modules;
+    // Run on each function once it is generated, then on the module
+    llvm::FunctionPassManager function;
+    llvm::ModulePassManager module;
+};
 
 llvm::AllocaInst * CodeGen::CreateAlloca(llvm::Function * function,
                                          std::string_view name,
@@ -40,34 +222,93 @@ llvm::AllocaInst * CodeGen::CreateAlloca(llvm::Function * function,
     return alloca;
 }
 
-CodeGen::CodeGen(const std::vector<std::unique_ptr<ast::Node>> & root)
+void CodeGen::bind(std::uint32_t slot,
+                   std::string_view name,
+                   llvm::Value * value)
+{
+    if (options.ssa)
+    {
+        ssa.write(slot, builder->GetInsertBlock(), value);
+        slots[slot] = value;
+    }
+    else
+    {
+        slots[slot] = CreateAlloca(
+            builder->GetInsertBlock()->getParent(), name, value);
+    }
+}
+
+llvm::Value * CodeGen::load(std::uint32_t slot, std::string_view name)
+{
+    if (options.ssa)
+        return ssa.read(slot, builder->GetInsertBlock(), name);
+    return builder->CreateLoad(
+        llvm::Type::getDoubleTy(*context), slots[slot], name);
+}
+
+void CodeGen::store(std::uint32_t slot, llvm::Value * value)
+{
+    if (options.ssa)
+        ssa.write(slot, builder->GetInsertBlock(), value);
+    else
+        builder->CreateStore(value, slots[slot]);
+}
+
+void CodeGen::seal(llvm::BasicBlock * block)
+{
+    if (options.ssa)
+        ssa.seal(block);
+}
+
+CodeGen::CodeGen(const std::vector<ast::Ptr<ast::Node>> & root)
+    : CodeGen(root, Options{})
+{}
+
+CodeGen::CodeGen(const std::vector<ast::Ptr<ast::Node>> & root,
+                 Options options)
     : context(std::make_unique<llvm::LLVMContext>())
     , builder(std::make_unique<llvm::IRBuilder<>>(*context))
     , module(std::make_unique<llvm::Module>("my cool jit", *context))
-    , fpm(std::make_unique<llvm::legacy::FunctionPassManager>(module.get()))
+    , pipeline(std::make_unique<Pipeline>(options))
     , root(root)
+    , options(options)
 {
-    // Promote allocas to registers.
-    fpm->add(llvm::createPromoteMemoryToRegisterPass());
-    // Do simple "peephole" optimizations and bit-twiddling optzns.
-    fpm->add(llvm::createInstructionCombiningPass());
-    // Reassociate expressions.
-    fpm->add(llvm::createReassociatePass());
-    // Eliminate Common SubExpressions.
-    fpm->add(llvm::createGVNPass());
-    // Simplify the control flow graph (deleting unreachable blocks, etc).
-    fpm->add(llvm::createCFGSimplificationPass());
-
-    fpm->doInitialization();
+    if (options.target)
+    {
+        module->setDataLayout(options.target->createDataLayout());
+        module->setTargetTriple(options.target->getTargetTriple().str());
+    }
 }
 
 CodeGen::~CodeGen() = default;
 
+llvm::Function * CodeGen::function(Symbol name) const
+{
+    return lookup(functions, name);
+}
+
+llvm::Value * CodeGen::slot(std::uint32_t slot) const
+{
+    return slot < slots.size() ? slots[slot] : nullptr;
+}
+
 const llvm::Module * CodeGen::operator()()
 {
     for (auto & node : root)
-        if (node)
-            node->accept(*this);
+    {
+        if (!node)
+            continue;
+
+        slots.assign(resolve(*node), nullptr);
+        result = std::monostate{};
+        dispatch(*node);
+        if (auto p = std::get_if<Error>(&result))
+            failures.push_back(std::move(p->msg));
+    }
+
+    counts.before = size(*module);
+    pipeline->module.run(*module, pipeline->modules);
+    counts.after = size(*module);
     return module.get();
 }
 
@@ -75,16 +316,14 @@ void CodeGen::visit(ast::Variable & variable)
 {
     using namespace std::literals;
 
-    if (const auto it = named_values.find(variable.name);
-        it == named_values.cend())
+    if (!slot(variable.slot))
     {
-        result = Error{std::string("Unknown symbol") + variable.name};
+        result = Error{std::string("Unknown symbol")
+                           .append(variable.name.str())};
     }
     else
     {
-        result = builder->CreateLoad(llvm::Type::getDoubleTy(*context),
-                                     it->second,
-                                     variable.name);
+        result = load(variable.slot, variable.name.str());
     }
 }
 
@@ -95,31 +334,72 @@ void CodeGen::visit(ast::Literal & literal)
 
 void CodeGen::visit(ast::BinExpr & bin_expr)
 {
-    llvm::Value *l = nullptr, *r = nullptr;
-    if (bin_expr.lhs)
-    {
-        result = std::monostate{};
-        bin_expr.lhs->accept(*this);
+    operators(bin_expr);
+}
 
-        if (auto p = std::get_if<llvm::Value *>(&result))
-            l = *p;
-    }
+void CodeGen::operators(ast::Expr & expr)
+{
+    // Values of the operands generated so far, null for those that failed
+    std::vector<llvm::Value *> values;
+    // The first error, which the others follow from
+    std::string error;
 
-    if (bin_expr.rhs)
+    const auto pop = [&]
     {
-        result = std::monostate{};
-        bin_expr.rhs->accept(*this);
-        if (auto p = std::get_if<llvm::Value *>(&result))
-            r = *p;
-    }
-    if (!l || !r)
+        const auto value = values.back();
+        values.pop_back();
+        return value;
+    };
+    const auto push = [&]
     {
-        result = Error("bad binary expression");
-        return;
-    }
+        const auto value = std::get_if<llvm::Value *>(&result);
+        values.push_back(value ? *value : nullptr);
+        if (const auto p = std::get_if<Error>(&result); p && error.empty())
+            error = p->msg;
+    };
+
+    // The walk takes a holder, nothing replaces the root
+    ast::Ptr<ast::Expr> root(&expr);
+    passes::operators(
+        root,
+        [&](ast::Ptr<ast::Expr> & operand)
+        {
+            result = std::monostate{};
+            if (operand)
+                dispatch(*operand);
+            else
+                result = Error{"missing operand"};
+            push();
+        },
+        [&](ast::Ptr<ast::Expr> & operation)
+        {
+            result = std::monostate{};
+            if (operation->kind == ast::Kind::BinExpr)
+            {
+                const auto r = pop();
+                const auto l = pop();
+                if (l && r)
+                    generate(static_cast<ast::BinExpr &>(*operation), l, r);
+            }
+            else if (const auto operand = pop())
+            {
+                generate(static_cast<ast::UnaryExpr &>(*operation), operand);
+            }
+            push();
+        });
+
+    if (values.back())
+        result = values.back();
+    else
+        result = Error{error.empty() ? "bad expression" : error};
+}
 
-    if (bin_expr.op.size() == 1)
-        switch (bin_expr.op.front())
+void CodeGen::generate(ast::BinExpr & bin_expr,
+                       llvm::Value * l,
+                       llvm::Value * r)
+{
+    if (bin_expr.op.id() < 256)
+        switch (bin_expr.op.id())
         {
         case '+':
         {
@@ -147,12 +427,12 @@ void CodeGen::visit(ast::BinExpr & bin_expr)
         }
         case '=':
         {
-            if (const auto lhs =
-                    dynamic_cast<const ast::Variable *>(bin_expr.lhs.get()))
-                if (auto it = named_values.find(lhs->name);
-                    it != named_values.end())
+            if (bin_expr.lhs && bin_expr.lhs->kind == ast::Kind::Variable)
+                if (const auto lhs =
+                        static_cast<ast::Variable &>(*bin_expr.lhs).slot;
+                    slot(lhs))
                 {
-                    builder->CreateStore(r, it->second);
+                    store(lhs, r);
                     result = r;
                     return;
                 }
@@ -163,15 +443,22 @@ void CodeGen::visit(ast::BinExpr & bin_expr)
             break;
         }
 
+    auto * function = this->function(bin_expr.op);
+    if (!function)
+    {
+        result = Error{std::string("Unknown binary operator ")
+                           .append(bin_expr.op.str())};
+        return;
+    }
+
     using Arg = llvm::Value *;
     Arg args[2] = {l, r};
-    auto * function = module->getFunction(bin_expr.op);
-    result = builder->CreateCall(function, args, bin_expr.op);
+    result = builder->CreateCall(function, args, bin_expr.op.str());
 }
 
 void CodeGen::visit(ast::CallExpr & call_expr)
 {
-    auto callee = module->getFunction(call_expr.name);
+    auto callee = function(call_expr.name);
     if (!callee)
     {
         result = Error{"Unknown function referenced"};
@@ -193,7 +480,7 @@ void CodeGen::visit(ast::CallExpr & call_expr)
         if (arg)
         {
             result = std::monostate{};
-            arg->accept(*this);
+            dispatch(*arg);
             auto a = std::get_if<llvm::Value *>(&result);
             if (!a || !*a)
                 goto err;
@@ -212,6 +499,13 @@ void CodeGen::visit(ast::CallExpr & call_expr)
 
 void CodeGen::visit(ast::ProtoType & prototype)
 {
+    // Redeclarations refer to the existing function
+    if (const auto function = this->function(prototype.name))
+    {
+        result = function;
+        return;
+    }
+
     auto signature = llvm::FunctionType::get(
         prototype.name == "main" ? llvm::Type::getInt32Ty(*context)
                                  : llvm::Type::getDoubleTy(*context),
@@ -221,15 +515,16 @@ void CodeGen::visit(ast::ProtoType & prototype)
 
     auto function = llvm::Function::Create(signature,
                                            llvm::Function::ExternalLinkage,
-                                           prototype.name,
+                                           prototype.name.str(),
                                            module.get());
 
     size_t i = 0;
     for (auto & arg : function->args())
     {
-        arg.setName(prototype.args[i++]);
+        arg.setName(prototype.args[i++].str());
     }
 
+    at(functions, prototype.name) = function;
     result = function;
 }
 
@@ -237,11 +532,11 @@ void CodeGen::visit(ast::Function & fun)
 {
     if (fun.prototype)
     {
-        auto function = module->getFunction(fun.prototype->name);
+        auto function = this->function(fun.prototype->name);
         if (!function)
         {
             result = std::monostate{};
-            fun.prototype->accept(*this);
+            dispatch(*fun.prototype);
             if (auto p = std::get_if<llvm::Function *>(&result))
                 function = *p;
         }
@@ -255,21 +550,29 @@ void CodeGen::visit(ast::Function & fun)
             return;
         }
 
+        const auto math = options.math | fun.math;
+        attributes(*function, math);
+        builder->setFastMathFlags(flags(math));
+
         auto * bb = llvm::BasicBlock::Create(*context, "entry", function);
         builder->SetInsertPoint(bb);
+        ssa.clear();
+        seal(bb);
 
-        named_values.clear();
+        // The names of the definition win over those of a prior extern, its
+        // parameters take the first slots
         for (auto & arg : function->args())
-            named_values.emplace(arg.getName(),
-                                 CreateAlloca(function, arg.getName(), &arg));
+            if (arg.getArgNo() < fun.prototype->args.size())
+                bind(arg.getArgNo(), arg.getName(), &arg);
 
         if (fun.body)
         {
             result = std::monostate{};
-            fun.body->accept(*this);
+            dispatch(*fun.body);
             auto ret = std::get_if<llvm::Value *>(&result);
             if (!ret || !*ret)
             {
+                at(functions, fun.prototype->name) = nullptr;
                 function->eraseFromParent();
                 goto err_body;
             }
@@ -284,7 +587,9 @@ void CodeGen::visit(ast::Function & fun)
 
             llvm::verifyFunction(*function);
 
-            fpm->run(*function);
+            pipeline->function.run(*function, pipeline->functions);
+            // The analyses are not needed again, they would pile up
+            pipeline->functions.clear(*function, function->getName());
 
             result = function;
         }
@@ -305,12 +610,13 @@ void CodeGen::visit(ast::Function & fun)
 void CodeGen::visit(ast::Extern & e)
 {
     if (e.prototype)
-        e.prototype->accept(*this);
+        dispatch(*e.prototype);
 }
 
-void CodeGen::visit(ast::Error & e)
+void CodeGen::visit(ast::Error &)
 {
-    result = Error{e.msg};
+    // Reported by the parser already
+    result = std::monostate{};
 }
 
 void CodeGen::visit(ast::ConditionalExpr & conditional)
@@ -318,7 +624,7 @@ void CodeGen::visit(ast::ConditionalExpr & conditional)
     if (conditional.condition)
     {
         result = std::monostate{};
-        conditional.condition->accept(*this);
+        dispatch(*conditional.condition);
         if (auto p = std::get_if<llvm::Value *>(&result))
         {
             auto condition_value = builder->CreateFCmpONE(
@@ -333,12 +639,14 @@ void CodeGen::visit(ast::ConditionalExpr & conditional)
             auto * third_block = llvm::BasicBlock::Create(*context, "ifcont");
 
             builder->CreateCondBr(condition_value, first_block, second_block);
+            seal(first_block);
+            seal(second_block);
 
             if (conditional.first)
             {
                 builder->SetInsertPoint(first_block);
                 result = std::monostate{};
-                conditional.first->accept(*this);
+                dispatch(*conditional.first);
                 if (auto p = std::get_if<llvm::Value *>(&result))
                 {
                     auto first_value = *p;
@@ -350,7 +658,7 @@ void CodeGen::visit(ast::ConditionalExpr & conditional)
                         function->getBasicBlockList().push_back(second_block);
                         builder->SetInsertPoint(second_block);
                         result = std::monostate{};
-                        conditional.second->accept(*this);
+                        dispatch(*conditional.second);
                         if (auto p = std::get_if<llvm::Value *>(&result))
                         {
                             auto second_value = *p;
@@ -360,6 +668,7 @@ void CodeGen::visit(ast::ConditionalExpr & conditional)
                             function->getBasicBlockList().push_back(
                                 third_block);
                             builder->SetInsertPoint(third_block);
+                            seal(third_block);
 
                             auto * phi_node = builder->CreatePHI(
                                 llvm::Type::getDoubleTy(*context), 2, "iftmp");
@@ -376,128 +685,320 @@ void CodeGen::visit(ast::ConditionalExpr & conditional)
     result = std::monostate{};
 }
 
+std::optional<CodeGen::Counted>
+CodeGen::counted(const ast::ForExpr & loop) const
+{
+    const auto start = integral(loop.init.get(), -exact, exact);
+    const auto step = loop.step ? integral(loop.step.get(), 1, exact)
+                                : std::optional<std::int64_t>(1);
+    const auto condition =
+        loop.condition && loop.condition->kind == ast::Kind::BinExpr
+            ? static_cast<const ast::BinExpr *>(loop.condition.get())
+            : nullptr;
+    if (!start || !step || !condition || condition->op.id() != '<'
+        || slot_of(condition->lhs.get()) != loop.slot)
+        return std::nullopt;
+
+    // Bounds above the range of the counter, NaN and infinities included,
+    // are left to the loop over doubles
+    const auto bound = condition->rhs.get();
+    const auto variable = slot_of(bound);
+    if (bound && bound->kind == ast::Kind::Literal)
+    {
+        if (!(static_cast<const ast::Literal *>(bound)->value <= exact))
+            return std::nullopt;
+    }
+    else if (variable == loop.slot || !slot(variable))
+    {
+        return std::nullopt;
+    }
+
+    Counted counted{*start, *step, bound, true};
+    bool assigned = false;
+    for (const auto expr :
+         {loop.condition.get(), loop.step.get(), loop.body.get()})
+        passes::walk(expr,
+                     [&](ast::Node & node)
+                     {
+                         if (node.kind == ast::Kind::ForExpr)
+                             counted.innermost = false;
+                         if (node.kind != ast::Kind::BinExpr)
+                             return;
+                         const auto & bin = static_cast<ast::BinExpr &>(node);
+                         if (bin.op.id() != '=')
+                             return;
+                         const auto target = slot_of(bin.lhs.get());
+                         assigned |= target == loop.slot
+                                     || (target == variable
+                                         && variable != ast::unresolved);
+                     });
+    if (assigned)
+        return std::nullopt;
+    return counted;
+}
+
 void CodeGen::visit(ast::ForExpr & f)
 {
     result = std::monostate{};
-    f.init->accept(*this);
+    dispatch(*f.init);
     if (auto p = std::get_if<llvm::Value *>(&result))
     {
         auto init = *p;
 
-        auto function = builder->GetInsertBlock()->getParent();
-        auto loop = llvm::BasicBlock::Create(*context, "loop", function);
-
-        auto loop_variable = CreateAlloca(function, f.name, init);
+        constexpr std::int64_t min = std::numeric_limits<std::int32_t>::min();
+        constexpr std::int64_t max = std::numeric_limits<std::int32_t>::max();
 
-        builder->CreateBr(loop);
-
-        builder->SetInsertPoint(loop);
-
-        llvm::AllocaInst * old = nullptr;
-        if (auto it = named_values.find(f.name); it != named_values.cend())
+        const auto counted = this->counted(f);
+        if (counted && counted->bound->kind == ast::Kind::Literal)
         {
-            old = it->second;
-            it->second = loop_variable;
+            // The counter is less than the bound while it is less than its
+            // ceiling. The body runs once for any bound up to the start.
+            const auto bound = static_cast<std::int64_t>(std::ceil(std::max(
+                static_cast<const ast::Literal &>(*counted->bound).value,
+                static_cast<double>(counted->start))));
+            // Counters of 32 bits convert to doubles in vector registers
+            const auto narrow =
+                counted->start >= min && bound <= max - counted->step;
+            if (!loop(f,
+                      *counted,
+                      llvm::ConstantInt::get(
+                          narrow ? llvm::Type::getInt32Ty(*context)
+                                 : llvm::Type::getInt64Ty(*context),
+                          bound,
+                          true)))
+                return;
         }
-        else
+        else if (counted && counted->innermost && counted->start >= min
+                 && counted->start <= max - counted->step)
+        {
+            // Whether the bound is in range is only known at run time, the
+            // loop over doubles runs for the others and NaN. Only innermost
+            // loops are generated twice, an outer one would be as many times
+            // as it is deep.
+            const auto & variable =
+                static_cast<const ast::Variable &>(*counted->bound);
+            const auto bound = load(variable.slot, variable.name.str());
+
+            const auto function = builder->GetInsertBlock()->getParent();
+            const auto in_range =
+                llvm::BasicBlock::Create(*context, "counted", function);
+            const auto out_of_range =
+                llvm::BasicBlock::Create(*context, "uncounted", function);
+            const auto after =
+                llvm::BasicBlock::Create(*context, "joined", function);
+
+            const auto type = llvm::Type::getDoubleTy(*context);
+            builder->CreateCondBr(
+                builder->CreateFCmpOLE(
+                    bound,
+                    llvm::ConstantFP::get(
+                        type, static_cast<double>(max - counted->step)),
+                    "in_range"),
+                in_range,
+                out_of_range);
+            seal(in_range);
+            seal(out_of_range);
+
+            // Ceiling of the bound, at least the start
+            builder->SetInsertPoint(in_range);
+            const auto start = llvm::ConstantFP::get(
+                type, static_cast<double>(counted->start));
+            const auto clamped = builder->CreateSelect(
+                builder->CreateFCmpOLT(bound, start), start, bound);
+            const auto integer = llvm::Type::getInt32Ty(*context);
+            const auto truncated = builder->CreateFPToSI(clamped, integer);
+            const auto ceiling = builder->CreateAdd(
+                truncated,
+                builder->CreateZExt(
+                    builder->CreateFCmpOLT(
+                        builder->CreateSIToFP(truncated, type), clamped),
+                    integer),
+                "bound");
+            if (!loop(f, *counted, ceiling))
+                return;
+            builder->CreateBr(after);
+
+            builder->SetInsertPoint(out_of_range);
+            if (!loop(f, init))
+                return;
+            builder->CreateBr(after);
+            seal(after);
+            builder->SetInsertPoint(after);
+        }
+        else if (!loop(f, init))
         {
-            named_values.emplace(f.name, loop_variable);
+            return;
         }
 
+        result =
+            llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*context));
+    }
+}
 
-        result = std::monostate{};
-        f.body->accept(*this);
+bool CodeGen::loop(ast::ForExpr & f, llvm::Value * init)
+{
+    auto function = builder->GetInsertBlock()->getParent();
+    auto loop = llvm::BasicBlock::Create(*context, "loop", function);
 
+    bind(f.slot, f.name.str(), init);
 
-        llvm::Value * next = nullptr;
-        auto current = builder->CreateLoad(llvm::Type::getDoubleTy(*context),
-                                           loop_variable,
-                                           f.name);
-        if (f.step)
-        {
-            result = std::monostate{};
-            f.step->accept(*this);
-            if (const auto p = std::get_if<llvm::Value *>(&result))
-            {
-                next = builder->CreateFAdd(current, *p, "next");
-            }
-        }
-        else
-        {
-            next =
-                builder->CreateFAdd(current,
-                                    llvm::ConstantFP::get(*context,
-                                                          llvm::APFloat(1.0)),
-                                    "next");
-        }
-
-        result = std::monostate{};
-        f.condition->accept(*this);
-        if (const auto p = std::get_if<llvm::Value *>(&result))
-        {
-            auto condition = builder->CreateFCmpONE(
-                *p,
-                llvm::ConstantFP::get(*context, llvm::APFloat(0.0)),
-                "condition");
+    builder->CreateBr(loop);
 
-            builder->CreateStore(next, loop_variable);
+    builder->SetInsertPoint(loop);
 
-            auto after = llvm::BasicBlock::Create(*context, "after", function);
-            builder->CreateCondBr(condition, loop, after);
+    std::optional<decltype(result)> failure;
+    part(*f.body, failure);
 
-            builder->SetInsertPoint(after);
-            if (old)
-                named_values[f.name] = old;
-            else
-                named_values.erase(f.name);
-        }
+    llvm::Value * next = nullptr;
+    auto current = load(f.slot, f.name.str());
+    if (f.step)
+    {
+        if (const auto step = part(*f.step, failure))
+            next = builder->CreateFAdd(current, step, "next");
+    }
+    else
+    {
+        next = builder->CreateFAdd(
+            current,
+            llvm::ConstantFP::get(*context, llvm::APFloat(1.0)),
+            "next");
+    }
 
-        result =
-            llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*context));
+    // A loop whose condition fails is left right away, its blocks are
+    // terminated either way
+    auto after = llvm::BasicBlock::Create(*context, "after", function);
+    if (const auto condition = part(*f.condition, failure))
+    {
+        const auto repeat = builder->CreateFCmpONE(
+            condition,
+            llvm::ConstantFP::get(*context, llvm::APFloat(0.0)),
+            "condition");
+        if (next)
+            store(f.slot, next);
+        builder->CreateCondBr(repeat, loop, after);
+    }
+    else
+    {
+        builder->CreateBr(after);
     }
+    seal(loop);
+    seal(after);
+
+    builder->SetInsertPoint(after);
+
+    if (failure)
+        result = std::move(*failure);
+    return !failure;
+}
+
+bool CodeGen::loop(ast::ForExpr & f,
+                   const Counted & counted,
+                   llvm::Value * bound)
+{
+    const auto type = bound->getType();
+    const auto preheader = builder->GetInsertBlock();
+    const auto function = preheader->getParent();
+    const auto loop = llvm::BasicBlock::Create(*context, "loop", function);
+
+    // The variable is the counter as a double, which is exact in range
+    bind(f.slot,
+         f.name.str(),
+         llvm::ConstantFP::get(llvm::Type::getDoubleTy(*context),
+                               static_cast<double>(counted.start)));
+    builder->CreateBr(loop);
+
+    builder->SetInsertPoint(loop);
+    const auto counter = builder->CreatePHI(type, 2, "counter");
+    counter->addIncoming(llvm::ConstantInt::get(type, counted.start, true),
+                         preheader);
+    store(f.slot,
+          builder->CreateSIToFP(
+              counter, llvm::Type::getDoubleTy(*context), f.name.str()));
+
+    std::optional<decltype(result)> failure;
+    part(*f.body, failure);
+
+    // Neither overflows in range
+    const auto next = builder->CreateNSWAdd(
+        counter, llvm::ConstantInt::get(type, counted.step, true), "next");
+    const auto condition = builder->CreateICmpSLT(counter, bound, "condition");
+    counter->addIncoming(next, builder->GetInsertBlock());
+
+    const auto after = llvm::BasicBlock::Create(*context, "after", function);
+    builder->CreateCondBr(condition, loop, after);
+    seal(loop);
+    seal(after);
+
+    builder->SetInsertPoint(after);
+
+    if (failure)
+        result = std::move(*failure);
+    return !failure;
+}
+
+llvm::Value *
+CodeGen::part(ast::Expr & expr, std::optional<decltype(result)> & failure)
+{
+    result = std::monostate{};
+    dispatch(expr);
+    if (const auto p = std::get_if<llvm::Value *>(&result); p && *p)
+        return *p;
+    if (!failure)
+        failure = std::move(result);
+    return nullptr;
 }
 
 void CodeGen::visit(ast::UnaryExpr & unary_expr)
 {
-    if (const auto function = module->getFunction(unary_expr.op))
+    operators(unary_expr);
+}
+
+void CodeGen::generate(ast::UnaryExpr & unary_expr, llvm::Value * operand)
+{
+    const auto function = this->function(unary_expr.op);
+    if (!function)
     {
-        if (unary_expr.operand)
-        {
-            result = std::monostate{};
-            unary_expr.operand->accept(*this);
-            if (const auto p = std::get_if<llvm::Value *>(&result))
-            {
-                using Arg = llvm::Value *;
-                Arg args[1] = {*p};
-                result = builder->CreateCall(function, args, unary_expr.op);
-            }
-        }
+        result = Error{std::string("Unknown unary operator ")
+                           .append(unary_expr.op.str())};
+        return;
     }
+
+    using Arg = llvm::Value *;
+    Arg args[1] = {operand};
+    result = builder->CreateCall(function, args, unary_expr.op.str());
 }
 
 void CodeGen::visit(ast::LetExpr & let)
 {
-    if (auto function = builder->GetInsertBlock()->getParent())
+    if (builder->GetInsertBlock()->getParent())
     {
-        auto old = named_values;
         result = std::monostate{};
+        auto slot = let.slot;
         for (auto & [name, value] : let.vars)
         {
             if (value)
-            {
-                value->accept(*this);
-                if (const auto p = std::get_if<llvm::Value *>(&result))
-                    named_values[name] = CreateAlloca(function, name, *p);
-            }
+                dispatch(*value);
+            // A binding whose value fails leaves its name unbound
+            if (const auto p =
+                    value ? std::get_if<llvm::Value *>(&result) : nullptr)
+                bind(slot, name.str(), *p);
+            else
+                slots[slot] = nullptr;
+            ++slot;
         }
 
         if (let.body)
         {
-            let.body->accept(*this);
+            dispatch(*let.body);
         }
-
-        named_values = std::move(old);
     }
 }
 
+std::ostream & operator<<(std::ostream & os, const CodeGen::Stats & stats)
+{
+    return os << stats.before.instructions << " instructions in "
+              << stats.before.functions << " functions before module passes, "
+              << stats.after.instructions << " in " << stats.after.functions
+              << " after";
+}
 }  // namespace mk
\ No newline at end of file
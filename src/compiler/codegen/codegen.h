@@ -4,10 +4,18 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 
-#include "compiler/parser/visitor.h"
+#include "ssa.h"
 
-#include <map>
+#include "compiler/lexer/symbol.h"
+#include "compiler/parser/ast.h"
+#include "compiler/passes/resolve.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
 #include <string_view>
 #include <variant>
 #include <vector>
@@ -15,66 +23,191 @@
 namespace llvm
 {
 class Module;
+class TargetMachine;
 class Value;
 class AllocaInst;
-namespace legacy
-{
-class FunctionPassManager;
-}
+class BasicBlock;
 }  // namespace llvm
 
 namespace mk
 {
-namespace ast
+// Optimization levels, from the fastest to compile to the fastest or the
+// smallest code:
+//
+//   O0          no optimization
+//   O1          each function is cleaned up once generated with mem2reg,
+//               instcombine, reassociate, GVN and simplifycfg
+//   O2, O3      LLVM's default pipelines over the whole module
+//   Os, Oz      LLVM's pipelines that optimize for size
+enum class OptLevel
 {
-class Node;
-}
-class CodeGen : private ast::Visitor
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+    Oz,
+};
+
+class CodeGen final : private ast::StaticVisitor<CodeGen>
 {
 public:
-    CodeGen(const std::vector<std::unique_ptr<ast::Node>> & root);
+    // Interprocedural optimization of the whole module once every item is
+    // generated, after the passes of the level: function attributes are
+    // inferred and calls inlined bottom up the call graph, constants are
+    // propagated across calls, then functions nothing calls are removed and
+    // identical ones merged
+    struct IPO
+    {
+        // Cost under which a call is inlined, LLVM's default is 225
+        int threshold = 225;
+        // Only main stays visible outside the module, so that functions
+        // inlined everywhere or never called can be removed. Modules that
+        // are linked with others must keep their functions visible.
+        bool internalize = false;
+    };
+
+    struct Options
+    {
+        // Builds SSA form while generating instead of keeping variables in
+        // stack slots for mem2reg to promote
+        bool ssa = false;
+        OptLevel level = OptLevel::O1;
+        std::optional<IPO> ipo;
+        // Relaxations of IEEE arithmetic for every function, a definition
+        // may add more of its own
+        ast::FastMath math = ast::FastMath::none;
+        // Machine the module is compiled for, which the optimizations need
+        // to know the costs of, and the vectorizer the width of vectors
+        llvm::TargetMachine * target = nullptr;
+    };
+
+    struct Size
+    {
+        // Defined functions only
+        std::size_t functions = 0;
+        std::size_t instructions = 0;
+    };
+    // Size of the module before and after the passes run on the whole of it
+    struct Stats
+    {
+        Size before;
+        Size after;
+    };
+
+    CodeGen(const std::vector<ast::Ptr<ast::Node>> & root);
+    CodeGen(const std::vector<ast::Ptr<ast::Node>> & root, Options options);
     ~CodeGen();
+    // Generates the items of root, items that fail are left out of the module
+    // and the parser's ast::Error items are skipped
     const llvm::Module * operator()();
 
+    // Errors of the items left out, in source order
+    const std::vector<std::string> & errors() const { return failures; }
+
+    const Stats & stats() const { return counts; }
+
     std::unique_ptr<llvm::LLVMContext> LLVMContext() &&
     {
         return std::move(context);
     }
 
 private:
-    void visit(ast::Variable &) override;
-    void visit(ast::Literal &) override;
-    void visit(ast::UnaryExpr &) override;
-    void visit(ast::BinExpr &) override;
-    void visit(ast::CallExpr &) override;
-    void visit(ast::ConditionalExpr &) override;
-    void visit(ast::ForExpr &) override;
-    void visit(ast::ProtoType &) override;
-    void visit(ast::Function &) override;
-    void visit(ast::LetExpr &) override;
-    void visit(ast::Extern &) override;
-    void visit(ast::Error &) override;
+    friend ast::StaticVisitor<CodeGen>;
+
+    void visit(ast::Variable &);
+    void visit(ast::Literal &);
+    void visit(ast::UnaryExpr &);
+    void visit(ast::BinExpr &);
+    void visit(ast::CallExpr &);
+    void visit(ast::ConditionalExpr &);
+    void visit(ast::ForExpr &);
+    void visit(ast::ProtoType &);
+    void visit(ast::Function &);
+    void visit(ast::LetExpr &);
+    void visit(ast::Extern &);
+    void visit(ast::Error &);
+
+    // Generates the operators under expr after their operands, which are
+    // visited as usual, see passes::operators
+    void operators(ast::Expr & expr);
+    void generate(ast::BinExpr & bin_expr, llvm::Value * l, llvm::Value * r);
+    void generate(ast::UnaryExpr & unary_expr, llvm::Value * operand);
+
+    // A for loop whose variable counts from an integral literal by an
+    // integral literal step while it is less than a bound, which the loop
+    // assigns neither of. It is lowered with an integer counter, so that
+    // LLVM can compute its trip count, unroll and vectorize it.
+    struct Counted
+    {
+        std::int64_t start;
+        std::int64_t step;
+        // A literal, or a variable read once before the loop
+        const ast::Expr * bound;
+        // The loop holds no other loop
+        bool innermost;
+    };
+    std::optional<Counted> counted(const ast::ForExpr & loop) const;
+    // Both loops return false when a part of the loop fails to generate, the
+    // failure is left in result.
+    // Loops over the variable as a double, which suits every loop
+    bool loop(ast::ForExpr & loop, llvm::Value * init);
+    // Loops while the counter is less than bound, an integer of the width of
+    // the counter which is at least the start
+    bool
+    loop(ast::ForExpr & loop, const Counted & counted, llvm::Value * bound);
 
     llvm::AllocaInst * CreateAlloca(llvm::Function * function,
                                     std::string_view name,
                                     llvm::Value * init = nullptr);
 
+    llvm::Function * function(Symbol name) const;
+    // Storage of a slot of the item generated, or its first value in SSA
+    // form, null when it is not bound
+    llvm::Value * slot(std::uint32_t slot) const;
+
+    // Access to the variables in the current block, in their stack slots or
+    // in SSA form
+    void bind(std::uint32_t slot, std::string_view name, llvm::Value * value);
+    llvm::Value * load(std::uint32_t slot, std::string_view name);
+    void store(std::uint32_t slot, llvm::Value * value);
+    // Every predecessor of block is known, only SSA form tracks them
+    void seal(llvm::BasicBlock * block);
+
     std::unique_ptr<llvm::LLVMContext> context;
     std::unique_ptr<llvm::IRBuilder<>> builder;
     std::unique_ptr<llvm::Module> module;
-    std::map<std::string, llvm::AllocaInst *> named_values;
-    std::unique_ptr<llvm::legacy::FunctionPassManager> fpm;
+    // Names of each item are resolved to slots before it is generated
+    passes::Resolve resolve;
+    std::vector<llvm::Value *> slots;
+    SSA ssa;
+    // Indexed by Symbol::id, null when the name is not bound
+    std::vector<llvm::Function *> functions;
+    // Pass managers and analyses of the optimization level
+    struct Pipeline;
+    std::unique_ptr<Pipeline> pipeline;
 
     struct Error
     {
-        Error(const std::string & msg) : msg(msg) { throw 1; }
+        Error(const std::string & msg) : msg(msg) {}
         std::string msg;
     };
     // Used to communicate the codegen result between different visited nodes
     std::variant<std::monostate, llvm::Function *, llvm::Value *, Error> result;
+    // Generates a part of a loop. The result of the first part that fails is
+    // kept in failure, so that the blocks of the loop can still be completed
+    // and sealed before the failure is passed on.
+    llvm::Value * part(ast::Expr & expr,
+                       std::optional<decltype(result)> & failure);
+    std::vector<std::string> failures;
+    Stats counts;
 
-    const std::vector<std::unique_ptr<ast::Node>> & root;
+    const std::vector<ast::Ptr<ast::Node>> & root;
+    const Options options;
 };
+
+// Prints the statistics in one line
+std::ostream & operator<<(std::ostream & os, const CodeGen::Stats & stats);
 }  // namespace mk
 
 #endif
\ No newline at end of file
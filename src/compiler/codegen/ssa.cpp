@@ -0,0 +1,137 @@
+#include "ssa.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Type.h"
+
+namespace mk
+{
+void SSA::write(std::uint32_t slot,
+                llvm::BasicBlock * block,
+                llvm::Value * value)
+{
+    auto & definitions = blocks[block].definitions;
+    if (definitions.size() <= slot)
+        definitions.resize(slot + 1);
+    definitions[slot] = value;
+}
+
+llvm::Value *
+SSA::read(std::uint32_t slot, llvm::BasicBlock * block, llvm::StringRef name)
+{
+    // Blocks of a single predecessor are walked up without recursing, the
+    // value found is then written to each of them
+    llvm::SmallVector<llvm::BasicBlock *, 8> path;
+    llvm::Value * value = nullptr;
+    while (true)
+    {
+        auto & current = blocks[block];
+        if (slot < current.definitions.size() && current.definitions[slot])
+        {
+            value = current.definitions[slot];
+            break;
+        }
+
+        if (!current.sealed)
+        {
+            const auto incomplete = phi(block, name);
+            current.incomplete.emplace_back(slot, incomplete);
+            value = incomplete;
+            write(slot, block, value);
+            break;
+        }
+
+        if (const auto predecessor = block->getUniquePredecessor())
+        {
+            path.push_back(block);
+            block = predecessor;
+            continue;
+        }
+
+        if (llvm::pred_empty(block))
+        {
+            value = llvm::UndefValue::get(llvm::Type::getDoubleTy(
+                block->getContext()));
+        }
+        else
+        {
+            // Written first so that loops back to block find the phi
+            const auto join = phi(block, name);
+            write(slot, block, join);
+            value = complete(slot, join, name);
+        }
+        write(slot, block, value);
+        break;
+    }
+
+    for (const auto block : path)
+        write(slot, block, value);
+    return value;
+}
+
+void SSA::seal(llvm::BasicBlock * block)
+{
+    auto & current = blocks[block];
+    // Completing a phi may read other slots of the block, which adds no
+    // incomplete phis once it is sealed
+    current.sealed = true;
+    const auto incomplete = std::move(current.incomplete);
+    for (const auto & [slot, phi] : incomplete)
+        complete(slot, phi, phi->getName().str());
+}
+
+llvm::PHINode * SSA::phi(llvm::BasicBlock * block, llvm::StringRef name)
+{
+    const auto type = llvm::Type::getDoubleTy(block->getContext());
+    if (block->empty())
+        return llvm::PHINode::Create(type, 0, name, block);
+    return llvm::PHINode::Create(type, 0, name, &block->front());
+}
+
+llvm::Value *
+SSA::complete(std::uint32_t slot, llvm::PHINode * phi, llvm::StringRef name)
+{
+    completing.push_back(phi);
+    const auto block = phi->getParent();
+    for (const auto predecessor : llvm::predecessors(block))
+        phi->addIncoming(read(slot, predecessor, name), predecessor);
+    completing.pop_back();
+    return simplify(phi);
+}
+
+llvm::Value * SSA::simplify(llvm::PHINode * phi)
+{
+    llvm::Value * same = nullptr;
+    for (const auto & operand : phi->incoming_values())
+    {
+        if (operand == same || operand == phi)
+            continue;
+        if (same)
+            return phi;
+        same = operand;
+    }
+    if (!same)
+        same = llvm::UndefValue::get(phi->getType());
+
+    // Phis that used this one may merge a single value now, they are held
+    // weakly since simplifying one may remove another
+    llvm::SmallVector<llvm::WeakVH, 8> users;
+    for (const auto user : phi->users())
+        if (user != phi && llvm::isa<llvm::PHINode>(user))
+            users.emplace_back(user);
+
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    // Same may be one of the users and be replaced in turn
+    const llvm::WeakTrackingVH value(same);
+    for (const auto & user : users)
+        if (user && !llvm::is_contained(completing, user))
+            simplify(llvm::cast<llvm::PHINode>(user));
+    return value;
+}
+}  // namespace mk
@@ -0,0 +1,66 @@
+#ifndef __SSA_H__
+#define __SSA_H__
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace llvm
+{
+class BasicBlock;
+class PHINode;
+class Value;
+}  // namespace llvm
+
+namespace mk
+{
+// Builds SSA form while the code is generated, after Braun et al., "Simple
+// and Efficient Construction of Static Single Assignment Form". Variables are
+// the slots of passes::Resolve. A read looks for the last write in the block
+// and otherwise in its predecessors, placing phis where paths join. Blocks
+// whose predecessors are not all known yet get operandless phis that are
+// completed when the block is sealed. Phis that turn out to merge a single
+// value are removed again.
+class SSA
+{
+public:
+    // Forgets the blocks of the function generated before
+    void clear() { blocks.clear(); }
+
+    void
+    write(std::uint32_t slot, llvm::BasicBlock * block, llvm::Value * value);
+    // The value of slot at the end of block so far, phis are named name
+    llvm::Value *
+    read(std::uint32_t slot, llvm::BasicBlock * block, llvm::StringRef name);
+    // Every predecessor of block is known, it must get no other
+    void seal(llvm::BasicBlock * block);
+
+private:
+    struct Block
+    {
+        // Last write to each slot, follows the phis that are replaced
+        std::vector<llvm::WeakTrackingVH> definitions;
+        std::vector<std::pair<std::uint32_t, llvm::PHINode *>> incomplete;
+        bool sealed = false;
+    };
+
+    llvm::PHINode * phi(llvm::BasicBlock * block, llvm::StringRef name);
+    // Adds an operand per predecessor then simplifies
+    llvm::Value *
+    complete(std::uint32_t slot, llvm::PHINode * phi, llvm::StringRef name);
+    // Replaces a phi of a single value other than itself with that value
+    llvm::Value * simplify(llvm::PHINode * phi);
+
+    std::unordered_map<llvm::BasicBlock *, Block> blocks;
+    // Phis whose operands are being added, they are simplified once all of
+    // them are
+    llvm::SmallVector<llvm::PHINode *, 8> completing;
+};
+}  // namespace mk
+
+#endif
@@ -2,9 +2,13 @@
 
 #include "compiler/codegen/codegen.h"
 #include "compiler/lexer/lexer.h"
+#include "compiler/parser/flat.h"
 #include "compiler/parser/parser.h"
+#include "compiler/parser/serialize.h"
+#include "compiler/passes/fold.h"
 
 #include "util/lld.h"
+#include "util/mapped_file.h"
 #include "util/overload.h"
 
 #include "llvm/Analysis/TargetLibraryInfo.h"
@@ -30,32 +34,76 @@
 
 
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace mk
 {
-
-Driver::Driver() = default;
-
-Driver::~Driver() = default;
-
-std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
-Driver::compile(const std::string_view & src) const
+namespace
 {
-    Lexer lexer(src);
-    Parser parser(lexer);
-    CodeGen codegen(parser.parse());
+// Prints each diagnostic as line:column: error: message
+void report(std::string_view src, const std::vector<Diagnostic> & diagnostics)
+{
+    // Diagnostics are sorted, the source is scanned for lines only once
+    std::size_t line = 1;
+    std::size_t begin = 0;
+    std::size_t scanned = 0;
+    for (const auto & [offset, message] : diagnostics)
+    {
+        for (; scanned < offset; ++scanned)
+        {
+            if (src[scanned] == '\n')
+            {
+                ++line;
+                begin = scanned + 1;
+            }
+        }
+        std::cerr << fmt::format(
+            "{}:{}: error: {}\n", line, offset - begin + 1, message);
+    }
+}
 
-    std::unique_ptr<llvm::Module> module(llvm::CloneModule(*codegen()));
+// Optimization of the machine code that matches level. O0 and O3 map as
+// clang maps them, the default O1 keeps the Default the backend ran at before
+// levels could be selected.
+llvm::CodeGenOpt::Level codegen_level(OptLevel level)
+{
+    switch (level)
+    {
+    case OptLevel::O0:
+        return llvm::CodeGenOpt::None;
+    case OptLevel::O3:
+        return llvm::CodeGenOpt::Aggressive;
+    default:
+        return llvm::CodeGenOpt::Default;
+    }
+}
 
-    return std::pair{std::move(codegen).LLVMContext(), std::move(module)};
+// Floating point options of the backend, the attributes of each function
+// take precedence but for contraction into FMAs
+llvm::TargetOptions target_options(ast::FastMath math)
+{
+    llvm::TargetOptions options;
+    options.AllowFPOpFusion = math & ast::FastMath::contract
+                                  ? llvm::FPOpFusion::Fast
+                                  : llvm::FPOpFusion::Standard;
+    options.UnsafeFPMath = math == ast::FastMath::fast;
+    options.NoNaNsFPMath = math & ast::FastMath::nnan;
+    options.NoInfsFPMath = math & ast::FastMath::ninf;
+    options.NoSignedZerosFPMath = math & ast::FastMath::nsz;
+    options.ApproxFuncFPMath = math & ast::FastMath::afn;
+    return options;
 }
 
-std::unique_ptr<llvm::TargetMachine> Driver::target(llvm::Module & ir) const
+// Machine code is generated for, the optimizer asks it about the costs of
+// instructions when it vectorizes
+std::unique_ptr<llvm::TargetMachine> machine(const Driver::Options & options)
 {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
@@ -73,24 +121,112 @@ std::unique_ptr<llvm::TargetMachine> Driver::target(llvm::Module & ir) const
         return nullptr;
     }
 
-    llvm::TargetOptions Options;
+    auto Options = target_options(options.math);
     // Options.NoFramePointerElim = true;
     Options.MCOptions.AsmVerbose = true;
 
     const auto CPU = "generic";
     const auto Features = "";
-    std::unique_ptr<llvm::TargetMachine> target_machine(
+    return std::unique_ptr<llvm::TargetMachine>(
         target->createTargetMachine(triple,
                                     CPU,
                                     Features,
                                     Options,
                                     llvm::Reloc::PIC_,
                                     llvm::CodeModel::Large,
-                                    llvm::CodeGenOpt::Default,
+                                    codegen_level(options.level),
                                     true));
+}
+
+std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
+generate(const std::vector<ast::Ptr<ast::Node>> & root,
+         const Driver::Options & options)
+{
+    // The literals made by folding live until the module is generated
+    ast::Arena arena;
+    passes::Fold fold(arena);
+    const auto items = fold(root);
+
+    const auto target = machine(options);
+    CodeGen codegen(items,
+                    {.ssa = options.ssa,
+                     .level = options.level,
+                     .ipo = options.ipo,
+                     .math = options.math,
+                     .target = target.get()});
+    std::unique_ptr<llvm::Module> module(llvm::CloneModule(*codegen()));
+    for (const auto & error : codegen.errors())
+        std::cerr << "error: " << error << std::endl;
+
+    return std::pair{std::move(codegen).LLVMContext(), std::move(module)};
+}
+}  // namespace
+
+Driver::Driver() = default;
+
+Driver::Driver(Options options) : options(options) {}
+
+Driver::~Driver() = default;
+
+Driver::Compiled Driver::compile(const std::string_view & src) const
+{
+    Lexer lexer(src);
+    const auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    const auto & root = parser.parse_parallel();
+    report(src, parser.diagnostics());
+    return generate(root, options);
+}
+
+Driver::Compiled Driver::compile(const File & src) const
+{
+    const util::MappedFile file(src.path);
+    if (!src.cache)
+        return compile(file.view());
+
+    const auto path = src.path + ".ast";
+    const auto fingerprint = ast::flat::fingerprint(file);
+    if (std::filesystem::exists(path))
+    {
+        const util::MappedFile cached(path);
+        if (const auto tree = ast::flat::deserialize(cached, fingerprint))
+        {
+            ast::Arena arena;
+            return generate(ast::flat::unflatten(*tree, arena), options);
+        }
+    }
+
+    Lexer lexer(file.view());
+    const auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    const auto & root = parser.parse_parallel();
+    report(file, parser.diagnostics());
+
+    // Sources with errors are parsed every time so that their diagnostics
+    // are reported every time. The cache is written aside and renamed into
+    // place, readers never see a partial file, and failing to write it is
+    // not an error.
+    if (parser.diagnostics().empty())
+    {
+        const auto partial = path + ".partial";
+        std::ofstream out(partial, std::ios::binary);
+        out << ast::flat::serialize(ast::flat::flatten(root), fingerprint);
+        out.close();
+        std::error_code ignored;
+        if (out)
+            std::filesystem::rename(partial, path, ignored);
+    }
+    return generate(root, options);
+}
+
+std::unique_ptr<llvm::TargetMachine> Driver::target(llvm::Module & ir) const
+{
+    auto target_machine = machine(options);
+    if (!target_machine)
+        return nullptr;
 
     ir.setDataLayout(target_machine->createDataLayout());
-    ir.setTargetTriple(triple);
+    ir.setTargetTriple(target_machine->getTargetTriple().str());
 
     return target_machine;
 }
@@ -107,7 +243,8 @@ Driver::execute(const llvm::Module & module) const
             .setMCJITMemoryManager(
                 std::make_unique<llvm::SectionMemoryManager>())
             .setVerifyModules(true)
-            .setOptLevel(llvm::CodeGenOpt::Default)
+            .setOptLevel(codegen_level(options.level))
+            .setTargetOptions(target_options(options.math))
             .create());
 
     auto main = execution_engine->getFunctionAddress("main");
@@ -154,6 +291,12 @@ Driver::operator()(const std::string_view & src, Execute)
 
 std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
 Driver::operator()(const std::vector<std::string_view> & srcs, Link)
+{
+    return link(srcs);
+}
+
+template <typename Source>
+Driver::Compiled Driver::link(const std::vector<Source> & srcs) const
 {
     // This workaround writes the module + context into a bitcode stream then
     // re-loads the module with a given context
@@ -189,8 +332,12 @@ void Driver::operator()(const std::string_view & src,
                         const Object::Args & args) const
 {
     auto [_, ir] = compile(src);
+    emit(*ir, args);
+}
 
-    const auto t = target(*ir);
+void Driver::emit(llvm::Module & ir, const Object::Args & args) const
+{
+    const auto t = target(ir);
 
     std::error_code EC;
     llvm::raw_fd_ostream dest(fmt::format("{}.o", args.outfile),
@@ -208,7 +355,7 @@ void Driver::operator()(const std::string_view & src,
     if (t->addPassesToEmitFile(pass, dest, nullptr, llvm::CGFT_ObjectFile))
         return;
 
-    pass.run(*ir);
+    pass.run(ir);
     dest.flush();
 }
 
@@ -216,20 +363,23 @@ void Driver::operator()(const std::string_view & src,
                         const Bitcode::Args & args) const
 {
     auto [_, ir] = compile(src);
+    emit(*ir, args);
+}
 
-    const auto t = target(*ir);
+void Driver::emit(llvm::Module & ir, const Bitcode::Args & args) const
+{
+    const auto t = target(ir);
 
     std::error_code EC;
     llvm::raw_fd_ostream stream(fmt::format("{}.bc", args.outfile),
                                 EC,
                                 llvm::sys::fs::OpenFlags::OF_None);
-    llvm::WriteBitcodeToFile(*ir, stream);
+    llvm::WriteBitcodeToFile(ir, stream);
 }
 
-bool Driver::operator()(const std::string_view & src,
-                        const Elf::Args & args) const
+bool Driver::emit(llvm::Module & ir, const Elf::Args & args) const
 {
-    (*this)(src, Object::Args{.outfile = args.outfile});
+    emit(ir, Object::Args{.outfile = args.outfile});
 
     std::vector<std::string> raw_args = {
         "ld",
@@ -261,25 +411,78 @@ void Driver::operator()(const std::string_view & src,
                         const IR::Args & args) const
 {
     auto [_, ir] = compile(src);
+    emit(*ir, args);
+}
 
+void Driver::emit(llvm::Module & ir, const IR::Args & args) const
+{
     std::error_code EC;
     llvm::raw_fd_ostream stream(fmt::format("{}.ll", args.outfile),
                                 EC,
                                 llvm::sys::fs::OpenFlags::OF_None);
 
-    ir->print(stream, nullptr);
+    ir.print(stream, nullptr);
 }
 
 bool Driver::operator()(const std::string_view & src,
                         const Executable::Args & args) const
 {
-    return (*this)(src, static_cast<const Elf::Args &>(args));
+    auto [_, ir] = compile(src);
+    return emit(*ir, args);
 }
 
 bool Driver::operator()(const std::string_view & src,
                         const Library::Shared::Args & args) const
 {
-    return (*this)(src, static_cast<const Elf::Args &>(args));
+    auto [_, ir] = compile(src);
+    return emit(*ir, args);
+}
+
+std::variant<std::monostate, int64_t, int32_t, double, char, void *>
+Driver::operator()(const File & src, Execute)
+{
+    const auto [context, ir] = compile(src);
+
+    const auto t = target(*ir);
+
+    return execute(*ir);
+}
+
+std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
+Driver::operator()(const std::vector<File> & srcs, Link)
+{
+    return link(srcs);
+}
+
+void Driver::operator()(const File & src, const Object::Args & args) const
+{
+    auto [_, ir] = compile(src);
+    emit(*ir, args);
+}
+
+void Driver::operator()(const File & src, const Bitcode::Args & args) const
+{
+    auto [_, ir] = compile(src);
+    emit(*ir, args);
+}
+
+bool Driver::operator()(const File & src,
+                        const Library::Shared::Args & args) const
+{
+    auto [_, ir] = compile(src);
+    return emit(*ir, args);
+}
+
+bool Driver::operator()(const File & src, const Executable::Args & args) const
+{
+    auto [_, ir] = compile(src);
+    return emit(*ir, args);
+}
+
+void Driver::operator()(const File & src, const IR::Args & args) const
+{
+    auto [_, ir] = compile(src);
+    emit(*ir, args);
 }
 
 Driver::Elf::Args::~Args() {}
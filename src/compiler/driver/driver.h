@@ -10,7 +10,11 @@
 
 #include "fmt/format.h"
 
+#include "compiler/codegen/codegen.h"
+
 #include <memory>
+#include <optional>
+#include <string>
 #include <variant>
 #include <vector>
 
@@ -26,6 +30,32 @@ class Driver
 {
 
 public:
+    // Settings shared by every mode
+    struct Options
+    {
+        // Optimization of the IR, which also picks how hard the backend
+        // optimizes the machine code
+        OptLevel level = OptLevel::O1;
+        // See CodeGen::Options
+        bool ssa = false;
+        // See CodeGen::IPO, sources linked together must not internalize
+        std::optional<CodeGen::IPO> ipo;
+        // Relaxations of IEEE arithmetic for every function, also the
+        // defaults of the backend
+        ast::FastMath math = ast::FastMath::none;
+    };
+
+    // Source file compiled in place from a memory mapping instead of a string.
+    // Sources are tokenized in one go, which throws std::length_error for
+    // files of 4 GiB or more.
+    struct File
+    {
+        std::string path;
+        // Keeps the parsed source in path + ".ast" and reuses it instead of
+        // parsing again for as long as the source is unchanged
+        bool cache = false;
+    };
+
     struct Execute
     {
     };
@@ -114,6 +144,7 @@ public:
     };
 
     Driver();
+    explicit Driver(Options options);
 
     ~Driver();
 
@@ -134,16 +165,42 @@ public:
 
     void operator()(const std::string_view & src, const IR::Args &) const;
 
-private:
-    bool operator()(const std::string_view & src, const Elf::Args &) const;
+    std::variant<std::monostate, int64_t, int32_t, double, char, void *>
+    operator()(const File & src, Execute);
 
     std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
-    compile(const std::string_view & src) const;
+    operator()(const std::vector<File> & srcs, Link);
+
+    void operator()(const File & src, const Object::Args &) const;
+    void operator()(const File & src, const Bitcode::Args &) const;
+
+    bool operator()(const File & src, const Library::Shared::Args &) const;
+
+    bool operator()(const File & src, const Executable::Args &) const;
+
+    void operator()(const File & src, const IR::Args &) const;
+
+private:
+    using Compiled = std::pair<std::unique_ptr<llvm::LLVMContext>,
+                               std::unique_ptr<llvm::Module>>;
+
+    Compiled compile(const std::string_view & src) const;
+    Compiled compile(const File & src) const;
+
+    template <typename Source>
+    Compiled link(const std::vector<Source> & srcs) const;
+
+    void emit(llvm::Module & ir, const Object::Args &) const;
+    void emit(llvm::Module & ir, const Bitcode::Args &) const;
+    void emit(llvm::Module & ir, const IR::Args &) const;
+    bool emit(llvm::Module & ir, const Elf::Args &) const;
 
     std::unique_ptr<llvm::TargetMachine> target(llvm::Module & ir) const;
 
     std::variant<std::monostate, int64_t, int32_t, double, char, void *>
     execute(const llvm::Module & module) const;
+
+    const Options options;
 };
 }  // namespace mk
 
@@ -0,0 +1,121 @@
+#ifndef __KEYWORDS_H__
+#define __KEYWORDS_H__
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace mk
+{
+// Compile time generated perfect hash over the spellings (Keyword::value) of
+// the given keywords. An identifier is classified with a single table probe
+// followed by at most one string comparison.
+template <typename... Keywords>
+class KeywordTable
+{
+public:
+    // Invokes f with a default constructed instance of the keyword spelled by
+    // word, returns false without invoking f if word is not a keyword
+    template <typename F>
+    static constexpr bool visit(std::string_view word, F && f)
+    {
+        const auto i = find(word);
+        return i != npos
+               && dispatch(i, f, std::index_sequence_for<Keywords...>{});
+    }
+
+    static constexpr bool contains(std::string_view word)
+    {
+        return find(word) != npos;
+    }
+
+private:
+    static constexpr std::size_t npos = sizeof...(Keywords);
+
+    static constexpr std::array<std::string_view, sizeof...(Keywords)> words =
+        {Keywords::value...};
+
+    static constexpr std::size_t size = std::bit_ceil(2 * words.size());
+    static constexpr int bits = std::countr_zero(size);
+
+    static constexpr std::size_t min_length = []
+    {
+        auto length = words.front().size();
+        for (const auto word : words)
+            length = std::min(length, word.size());
+        return length;
+    }();
+
+    static constexpr std::size_t max_length = []
+    {
+        std::size_t length = 0;
+        for (const auto word : words)
+            length = std::max(length, word.size());
+        return length;
+    }();
+
+    // Multiplicative hash of the first character, the last character and the
+    // length of the word
+    static constexpr std::size_t hash(std::string_view word,
+                                      std::uint32_t seed)
+    {
+        const std::uint32_t first = static_cast<unsigned char>(word.front());
+        const std::uint32_t last = static_cast<unsigned char>(word.back());
+        const std::uint32_t key =
+            first << 16 | last << 8 | static_cast<std::uint32_t>(word.size());
+        return (key * seed) >> (32 - bits);
+    }
+
+    struct Layout
+    {
+        std::uint32_t seed = 0;
+        std::array<std::size_t, size> slots{};
+    };
+
+    // Searches for a seed that maps every keyword to a distinct slot
+    static constexpr Layout layout = []
+    {
+        for (std::uint32_t seed = 0x9e3779b1; seed != 0x9e3779b1 + 2 * 4096;
+             seed += 2)
+        {
+            Layout layout{seed};
+            layout.slots.fill(npos);
+            bool collision = false;
+            for (std::size_t i = 0; i < words.size() && !collision; ++i)
+            {
+                auto & slot = layout.slots[hash(words[i], seed)];
+                collision = slot != npos;
+                slot = i;
+            }
+            if (!collision)
+                return layout;
+        }
+        return Layout{};
+    }();
+
+    static_assert(layout.seed != 0,
+                  "no perfect hash found for the keywords, make sure their "
+                  "first character, last character and length differ");
+
+    static constexpr std::size_t find(std::string_view word)
+    {
+        if (word.size() < min_length || word.size() > max_length)
+            return npos;
+        const auto i = layout.slots[hash(word, layout.seed)];
+        return i != npos && words[i] == word ? i : npos;
+    }
+
+    template <typename F, std::size_t... I>
+    static constexpr bool
+    dispatch(std::size_t i, F & f, std::index_sequence<I...>)
+    {
+        return ((i == I ? (f(Keywords{}), true) : false) || ...);
+    }
+};
+}  // namespace mk
+
+#endif
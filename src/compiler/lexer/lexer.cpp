@@ -1,133 +1,247 @@
 #include "lexer.h"
 
-#include <cctype>
-#include <cstdlib>
+#include "scan.h"
+
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
 
-#include <iostream>
 namespace mk
 {
-Lexer::Lexer(const std::string_view & input) : input(input), token() {}
+namespace
+{
+// Drops the prefix of input that scan runs over
+template <typename Scan>
+void skip(std::string_view & input, Scan scan)
+{
+    const auto begin = input.data();
+    input.remove_prefix(scan(begin, begin + input.size()) - begin);
+}
 
-void Lexer::next()
+const char * skip_xdigits(const char * p, const char * end)
+{
+    while (p != end && scan::is_xdigit(*p))
+        ++p;
+    return p;
+}
+
+// Lexes the numeric literal starting at begin, whose first digit was already
+// consumed from input:
+//   decimal := digit+ [. digit*] [(e|E) [+|-] digit+]
+//   hex     := 0(x|X) hexdigit+ [. hexdigit*] [(p|P) [+|-] digit+]
+// Hex literals denote the exact binary value, so that generated constant
+// tables can be printed with %a and read back without rounding
+Token number(std::string_view & input, const char * begin, std::size_t offset)
+{
+    const bool hex = *begin == '0' && input.size() > 1
+                     && (input[0] == 'x' || input[0] == 'X')
+                     && scan::is_xdigit(input[1]);
+    if (hex)
+    {
+        input.remove_prefix(1);
+        begin = input.data();
+    }
+
+    const auto digits = hex ? skip_xdigits : scan::skip_digits;
+
+    skip(input, digits);
+    if (!input.empty() && input.front() == '.')
+    {
+        input.remove_prefix(1);
+        skip(input, digits);
+
+        if (!input.empty() && input.front() == '.')
+        {
+            // Swallow the rest of the malformed literal so that lexing
+            // resumes after it
+            while (!input.empty()
+                   && (input.front() == '.' || scan::is_digit(input.front())))
+                input.remove_prefix(1);
+            return Invalid("Invalid floating point number", offset);
+        }
+    }
+
+    // The exponent is only part of the literal if it has digits, otherwise
+    // the letter starts the next token
+    if (!input.empty() && (input.front() | 0x20) == (hex ? 'p' : 'e'))
+    {
+        std::size_t i = 1;
+        if (i < input.size() && (input[i] == '+' || input[i] == '-'))
+            ++i;
+        if (i < input.size() && scan::is_digit(input[i]))
+        {
+            input.remove_prefix(i);
+            skip(input, scan::skip_digits);
+        }
+    }
+
+    double value;
+    const auto [end, error] =
+        std::from_chars(begin,
+                        input.data(),
+                        value,
+                        hex ? std::chars_format::hex
+                            : std::chars_format::general);
+    if (error == std::errc::result_out_of_range)
+        return Invalid("Floating point number out of range", offset);
+    if (error != std::errc() || end != input.data())
+        return Invalid("Invalid floating point number", offset);
+    return value;
+}
+}  // namespace
+
+Lexer::Lexer(const std::string_view & input)
+    : source(input), input(input), token()
+{}
+
+Lexer::Lexer(const std::string_view & input, std::size_t position)
+    : source(input), input(input.substr(position)), token()
+{}
+
+Lexer::Lexer(std::istream & stream, std::size_t chunk)
+    : token(), stream(&stream), chunk(chunk)
+{
+    buffer.reserve(chunk);
+    source = input = buffer;
+}
+
+bool Lexer::fill(const char * from)
 {
+    if (!stream || !*stream)
+        return false;
+
+    const std::size_t keep = from - buffer.data();
+    base += keep;
+    buffer.erase(0, keep);
+
+    const auto size = buffer.size();
+    buffer.resize(size + chunk);
+    stream->read(buffer.data() + size, chunk);
+    buffer.resize(size + stream->gcount());
+
+    source = input = buffer;
+    return true;
+}
+
+Token Lexer::lex(std::string_view & lexeme)
+{
+    // Deciding where a token ends looks at most 3 bytes past it ("1e+5"), so
+    // a token that ends closer than that to the end of a chunk may continue in
+    // the next one and is lexed again once it has been read
+    constexpr std::size_t lookahead = 4;
+
+    while (true)
+    {
+        auto result = match(lexeme);
+        if (!stream || input.size() >= lookahead)
+            return result;
+        if (!fill(result.is<Empty>() ? input.data() : lexeme.data()))
+            return result;
+    }
+}
+
+Token Lexer::match(std::string_view & lexeme)
+{
+    if (comment)
+    {
+        skip(input, scan::skip_comment);
+        comment = input.empty();
+    }
+
     while (!input.empty())
     {
         unsigned char c = input.front();
         input.remove_prefix(1);
 
-        if (std::isspace(c))
+        if (scan::is_space(c))
         {
+            skip(input, scan::skip_space);
             continue;
         }
         else if (c == '#')
         {
-            while (!input.empty() && c != '\n' && c != '\r')
-            {
-                c = input.front();
-                input.remove_prefix(1);
-            }
+            skip(input, scan::skip_comment);
+            comment = input.empty();
             continue;
         }
-        else if (std::isalpha(c))
+
+        const auto begin = input.data() - 1;
+        Token result = Empty{};
+
+        if (scan::is_alpha(c))
         {
-            std::string value;
-            value += c;
+            skip(input, scan::skip_alnum);
 
-            while (!input.empty() && std::isalnum(c = input.front()))
-            {
-                value += c;
-                input.remove_prefix(1);
-            }
-
-            if (value == Def::value)
-            {
-                token = Def();
-            }
-            else if (value == Extern::value)
-            {
-                token = Extern();
-            }
-            else if (value == If::value)
-            {
-                token = If();
-            }
-            else if (value == Then::value)
-            {
-                token = Then();
-            }
-            else if (value == Else::value)
-            {
-                token = Else();
-            }
-            else if (value == For::value)
-            {
-                token = For();
-            }
-            else if (value == In::value)
-            {
-                token = In();
-            }
-            else if (value == Let::value)
-            {
-                token = Let();
-            }
-            else if (value == "operator")
-            {
-                while (!input.empty() && std::isspace(c = input.front()))
-                    input.remove_prefix(1);
-                std::string opcode;
-                while (!input.empty() && !std::isspace(c = input.front())
-                       && c != '(' && !std::isdigit(c))
+            const std::string_view value(begin, input.data() - begin);
+
+            const auto keyword = Keywords::visit(
+                value,
+                [&](auto keyword)
                 {
-                    opcode += c;
-                    input.remove_prefix(1);
-                }
-                token = Operator(std::move(opcode));
-            }
-            else
-            {
-                token = Identifier(std::move(value));
-            }
+                    if constexpr (std::is_same_v<decltype(keyword),
+                                                 OperatorKeyword>)
+                    {
+                        skip(input, scan::skip_space);
+                        const auto opcode = input.data();
+                        while (!input.empty()
+                               && !scan::is_space(c = input.front())
+                               && c != '(' && !scan::is_digit(c))
+                        {
+                            input.remove_prefix(1);
+                        }
+                        result = Operator(
+                            std::string_view(opcode, input.data() - opcode));
+                    }
+                    else
+                    {
+                        result = keyword;
+                    }
+                });
+
+            if (!keyword)
+                result = Identifier(value);
         }
-        else if (std::isdigit(c))
+        else if (scan::is_digit(c))
         {
-            std::string value;
-            value += c;
-            bool floating_point = false;
-
-        number:
-            while (!input.empty() && std::isdigit(c = input.front()))
-            {
-                value += c;
-                input.remove_prefix(1);
-            }
-
-            if (c == '.')
-            {
-                if (floating_point)
-                {
-                    token = Invalid("Invalid floating point number");
-                }
-                else
-                {
-                    floating_point = true;
-                    value += c;
-                    input.remove_prefix(1);
-                    goto number;
-                }
-            }
-            else
-            {
-                token = std::stod(value);
-            }
+            result = number(input, begin, base + (begin - source.data()));
         }
         else
         {
-            token = c;
+            result = c;
         }
-        return;
+
+        lexeme = std::string_view(begin, input.data() - begin);
+        return result;
     }
+    lexeme = input;
+    return Empty{};
+}
+
+void Lexer::next()
+{
+    token = lex(text);
+}
+
+TokenStream Lexer::tokenize()
+{
+    // The stream borrows from the whole input
+    assert(!this->stream);
+
+    // The stream addresses the input with 32 bit offsets
+    if (source.size() > std::numeric_limits<std::uint32_t>::max())
+        throw std::length_error("inputs of 4 GiB or more cannot be tokenized");
+
+    TokenStream stream(source);
+    // A rough guess of the token density that avoids most regrowth
+    stream.reserve(input.size() / 4);
+    for (auto t = lex(text); !t.is<Empty>(); t = lex(text))
+        stream.push_back(t, text);
     token = Empty{};
+    return stream;
 }
 
 const Token & Lexer::current() const
@@ -135,5 +249,15 @@ const Token & Lexer::current() const
     return token;
 }
 
+std::size_t Lexer::offset() const
+{
+    return base + (input.data() - source.data());
+}
+
+std::string_view Lexer::lexeme() const
+{
+    return text;
+}
+
 
 }  // namespace mk
\ No newline at end of file
@@ -2,7 +2,11 @@
 #define __LEXER_H__
 
 #include "token.h"
+#include "token_stream.h"
 
+#include <cstddef>
+#include <istream>
+#include <string>
 #include <string_view>
 
 
@@ -12,13 +16,46 @@ class Lexer
 {
 public:
     Lexer(const std::string_view & input);
+    // Starts lexing input at position, offsets stay relative to input
+    Lexer(const std::string_view & input, std::size_t position);
+    // Reads the input from stream in chunks of the given size, memory is
+    // bounded by the chunk size plus the longest token. Tokens hold interned
+    // symbols and stay valid, only lexeme() borrows from the chunk and is
+    // valid until the next call to next()
+    Lexer(std::istream & stream, std::size_t chunk = 1 << 16);
 
     void next();
     const Token & current() const;
 
+    // Lexes the rest of an in memory input in one go, the Lexer is exhausted
+    // afterwards. Throws std::length_error for inputs of 4 GiB or more, which
+    // the stream cannot address.
+    TokenStream tokenize();
+
+    // Position in the input right past the current token
+    std::size_t offset() const;
+    // Input text the current token was lexed from
+    std::string_view lexeme() const;
+
 private:
+    Token lex(std::string_view & lexeme);
+    Token match(std::string_view & lexeme);
+    // Drops the buffered input before from and appends the next chunk,
+    // returns false once the stream is exhausted
+    bool fill(const char * from);
+
+    std::string_view source;
     std::string_view input;
+    std::string_view text;
     Token token;
+
+    std::istream * stream = nullptr;
+    std::size_t chunk = 0;
+    std::string buffer;
+    // Position of source in the stream
+    std::size_t base = 0;
+    // Whether the last chunk ended inside a comment
+    bool comment = false;
 };
 }  // namespace mk
 
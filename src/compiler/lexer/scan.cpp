@@ -0,0 +1,205 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace mk
+{
+namespace scan
+{
+namespace detail
+{
+namespace
+{
+namespace scalar
+{
+template <std::uint8_t Mask>
+const char * skip(const char * p, const char * end)
+{
+    while (p != end && is(*p, Mask))
+        ++p;
+    return p;
+}
+
+const char * space(const char * p, const char * end)
+{
+    return skip<Space>(p, end);
+}
+
+const char * comment(const char * p, const char * end)
+{
+    while (p != end && !is(*p, Newline))
+        ++p;
+    return p;
+}
+
+const char * alnum(const char * p, const char * end)
+{
+    return skip<Alpha | Digit>(p, end);
+}
+
+const char * digits(const char * p, const char * end)
+{
+    return skip<Digit>(p, end);
+}
+}  // namespace scalar
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Both vector flavours share the same structure: classify a whole block with
+// a handful of compares, then locate the first byte that left the run in the
+// resulting bit mask.
+//
+// Unsigned range checks are done as min(x - lo, n) == x - lo since SSE2 and
+// AVX2 only provide signed byte comparisons.
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace sse2
+{
+using V = __m128i;
+
+inline V in_range(V x, char lo, char n)
+{
+    const auto t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(n)), t);
+}
+
+inline V is_space(V x)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                        in_range(x, '\t', '\r' - '\t'));
+}
+
+inline V is_not_newline(V x)
+{
+    return _mm_cmpeq_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                                       _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))),
+                          _mm_setzero_si128());
+}
+
+inline V is_digit(V x)
+{
+    return in_range(x, '0', '9' - '0');
+}
+
+inline V is_alnum(V x)
+{
+    return _mm_or_si128(
+        in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z' - 'a'),
+        is_digit(x));
+}
+
+template <V (*Predicate)(V), Kernel Tail>
+const char * skip(const char * p, const char * end)
+{
+    for (; end - p >= 16; p += 16)
+    {
+        const auto x = _mm_loadu_si128(reinterpret_cast<const V *>(p));
+        const std::uint32_t mask = _mm_movemask_epi8(Predicate(x)) ^ 0xffff;
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return Tail(p, end);
+}
+
+constexpr Kernel space = skip<is_space, scalar::space>;
+constexpr Kernel comment = skip<is_not_newline, scalar::comment>;
+constexpr Kernel alnum = skip<is_alnum, scalar::alnum>;
+constexpr Kernel digits = skip<is_digit, scalar::digits>;
+}  // namespace sse2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2
+{
+using V = __m256i;
+
+inline V in_range(V x, char lo, char n)
+{
+    const auto t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(n)), t);
+}
+
+inline V is_space(V x)
+{
+    return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                           in_range(x, '\t', '\r' - '\t'));
+}
+
+inline V is_not_newline(V x)
+{
+    return _mm256_cmpeq_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))),
+        _mm256_setzero_si256());
+}
+
+inline V is_digit(V x)
+{
+    return in_range(x, '0', '9' - '0');
+}
+
+inline V is_alnum(V x)
+{
+    return _mm256_or_si256(
+        in_range(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a'),
+        is_digit(x));
+}
+
+template <V (*Predicate)(V), Kernel Tail>
+const char * skip(const char * p, const char * end)
+{
+    for (; end - p >= 32; p += 32)
+    {
+        const auto x = _mm256_loadu_si256(reinterpret_cast<const V *>(p));
+        const std::uint32_t mask = ~_mm256_movemask_epi8(Predicate(x));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return Tail(p, end);
+}
+
+constexpr Kernel space = skip<is_space, sse2::space>;
+constexpr Kernel comment = skip<is_not_newline, sse2::comment>;
+constexpr Kernel alnum = skip<is_alnum, sse2::alnum>;
+constexpr Kernel digits = skip<is_digit, sse2::digits>;
+}  // namespace avx2
+#pragma GCC pop_options
+
+Kernel select(Kernel avx2, Kernel sse2)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? avx2 : sse2;
+}
+
+// Stores the kernel for the host in place of itself and runs it. Threads that
+// resolve at the same time store the same kernel.
+template <std::atomic<Kernel> & Slot, Kernel Avx2, Kernel Sse2>
+const char * resolve(const char * p, const char * end)
+{
+    const auto kernel = select(Avx2, Sse2);
+    Slot.store(kernel, std::memory_order_relaxed);
+    return kernel(p, end);
+}
+#endif
+}  // namespace
+
+#if defined(__x86_64__) || defined(__i386__)
+constinit std::atomic<Kernel> space{resolve<space, avx2::space, sse2::space>};
+constinit std::atomic<Kernel> comment{
+    resolve<comment, avx2::comment, sse2::comment>};
+constinit std::atomic<Kernel> alnum{resolve<alnum, avx2::alnum, sse2::alnum>};
+constinit std::atomic<Kernel> digits{
+    resolve<digits, avx2::digits, sse2::digits>};
+#else
+constinit std::atomic<Kernel> space{scalar::space};
+constinit std::atomic<Kernel> comment{scalar::comment};
+constinit std::atomic<Kernel> alnum{scalar::alnum};
+constinit std::atomic<Kernel> digits{scalar::digits};
+#endif
+}  // namespace detail
+}  // namespace scan
+}  // namespace mk
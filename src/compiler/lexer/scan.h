@@ -0,0 +1,141 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace mk
+{
+namespace scan
+{
+enum Class : std::uint8_t
+{
+    Space = 1 << 0,
+    Alpha = 1 << 1,
+    Digit = 1 << 2,
+    Newline = 1 << 3,
+    Hex = 1 << 4,
+    Punct = 1 << 5,
+};
+
+// Character classes of the "C" locale, the lexer must not depend on the
+// locale of the process it runs in
+constexpr auto classes = []
+{
+    std::array<std::uint8_t, 256> classes{};
+    for (const unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+        classes[c] |= Space;
+    for (const unsigned char c : {'\n', '\r'})
+        classes[c] |= Newline;
+    for (unsigned char c = 'a'; c <= 'z'; ++c)
+        classes[c] |= Alpha;
+    for (unsigned char c = 'A'; c <= 'Z'; ++c)
+        classes[c] |= Alpha;
+    for (unsigned char c = '0'; c <= '9'; ++c)
+        classes[c] |= Digit | Hex;
+    for (unsigned char c = 'a'; c <= 'f'; ++c)
+        classes[c] |= Hex;
+    for (unsigned char c = 'A'; c <= 'F'; ++c)
+        classes[c] |= Hex;
+    for (unsigned char c = '!'; c <= '~'; ++c)
+        if (!(classes[c] & (Alpha | Digit)))
+            classes[c] |= Punct;
+    return classes;
+}();
+
+constexpr bool is(char c, std::uint8_t mask)
+{
+    return classes[static_cast<unsigned char>(c)] & mask;
+}
+
+constexpr bool is_space(char c)
+{
+    return is(c, Space);
+}
+
+constexpr bool is_alpha(char c)
+{
+    return is(c, Alpha);
+}
+
+constexpr bool is_digit(char c)
+{
+    return is(c, Digit);
+}
+
+constexpr bool is_alnum(char c)
+{
+    return is(c, Alpha | Digit);
+}
+
+constexpr bool is_xdigit(char c)
+{
+    return is(c, Hex);
+}
+
+constexpr bool is_punct(char c)
+{
+    return is(c, Punct);
+}
+
+namespace detail
+{
+using Kernel = const char * (*)(const char *, const char *);
+
+// Selected according to the instruction sets of the host, AVX2 or SSE2 on x86
+// and a table driven scalar loop elsewhere. They are constant initialized to
+// a resolver that selects the kernel on first use and stores it in place, so
+// that lexing during the static initialization of another translation unit
+// finds them set.
+extern std::atomic<Kernel> space;
+extern std::atomic<Kernel> comment;
+extern std::atomic<Kernel> alnum;
+extern std::atomic<Kernel> digits;
+
+// Runs of a single character are the common case, they are handled inline
+// before paying for the call into the vectorized kernel
+inline const char * run(const char * p,
+                        const char * end,
+                        std::uint8_t mask,
+                        const std::atomic<Kernel> & kernel)
+{
+    if (p == end || !is(*p, mask))
+        return p;
+    if (++p == end || !is(*p, mask))
+        return p;
+    return kernel.load(std::memory_order_relaxed)(p, end);
+}
+}  // namespace detail
+
+// Each function returns the first position in [p, end) that does not belong
+// to the scanned run, or end
+
+// Whitespace as defined by Space
+inline const char * skip_space(const char * p, const char * end)
+{
+    return detail::run(p, end, Space, detail::space);
+}
+
+// Body of a comment, stops at the line terminator
+inline const char * skip_comment(const char * p, const char * end)
+{
+    return p == end || is(*p, Newline)
+               ? p
+               : detail::comment.load(std::memory_order_relaxed)(p, end);
+}
+
+// Tail of an identifier
+inline const char * skip_alnum(const char * p, const char * end)
+{
+    return detail::run(p, end, Alpha | Digit, detail::alnum);
+}
+
+inline const char * skip_digits(const char * p, const char * end)
+{
+    return detail::run(p, end, Digit, detail::digits);
+}
+}  // namespace scan
+}  // namespace mk
+
+#endif
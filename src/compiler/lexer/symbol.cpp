@@ -0,0 +1,180 @@
+#include "symbol.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mk
+{
+namespace
+{
+// Backing storage for single byte names so that they can be handed out as
+// std::string_view like the others
+constexpr auto characters = []
+{
+    std::array<char, 256> characters{};
+    for (std::size_t i = 0; i < characters.size(); ++i)
+        characters[i] = static_cast<char>(i);
+    return characters;
+}();
+
+// Names by id in blocks that never move once allocated, block k holds
+// first << k of them. Entries are written before their id is handed out and
+// never change afterwards, so that they are read without locking.
+class Names
+{
+public:
+    Names() = default;
+    Names(const Names &) = delete;
+    Names & operator=(const Names &) = delete;
+
+    ~Names()
+    {
+        for (const auto & block : blocks)
+            delete[] block.load(std::memory_order_relaxed);
+    }
+
+    std::string_view operator[](Symbol::Id id) const
+    {
+        const auto [block, index] = locate(id);
+        return blocks[block].load(std::memory_order_acquire)[index];
+    }
+
+    Symbol::Id size() const { return count.load(std::memory_order_acquire); }
+
+    // Writers are serialized by the caller
+    void push_back(std::string_view name)
+    {
+        const auto id = count.load(std::memory_order_relaxed);
+        const auto [block, index] = locate(id);
+        auto entries = blocks[block].load(std::memory_order_relaxed);
+        if (!entries)
+        {
+            entries = new std::string_view[first << block];
+            blocks[block].store(entries, std::memory_order_release);
+        }
+        entries[index] = name;
+        count.store(id + 1, std::memory_order_release);
+    }
+
+private:
+    static constexpr int shift = 9;
+    static constexpr std::uint64_t first = 1 << shift;
+
+    // Block and index in the block of the entry of id
+    static std::pair<std::size_t, std::size_t> locate(Symbol::Id id)
+    {
+        const auto position = id + first;
+        const std::size_t block = std::bit_width(position) - 1 - shift;
+        return {block, position - (first << block)};
+    }
+
+    // Enough for every 32 bit id
+    std::array<std::atomic<std::string_view *>, 33 - shift> blocks{};
+    std::atomic<Symbol::Id> count = 0;
+};
+
+class Table
+{
+public:
+    Table()
+    {
+        for (std::size_t i = 0; i < 257; ++i)
+            names.push_back({});
+    }
+
+    Symbol::Id intern(std::string_view name)
+    {
+        {
+            std::shared_lock lock(mutex);
+            if (const auto it = ids.find(name); it != ids.cend())
+                return it->second;
+        }
+
+        std::lock_guard lock(mutex);
+        if (const auto it = ids.find(name); it != ids.cend())
+            return it->second;
+
+        const auto text = store(name);
+        const Symbol::Id id = names.size();
+        names.push_back(text);
+        ids.emplace(text, id);
+        return id;
+    }
+
+    std::string_view str(Symbol::Id id) const { return names[id]; }
+
+    Symbol::Id count() const { return names.size(); }
+
+private:
+    // Copies name into the current block, names are small so the space lost
+    // at the end of a block is negligible
+    std::string_view store(std::string_view name)
+    {
+        constexpr std::size_t block = 64 * 1024;
+
+        if (name.size() > capacity - used)
+        {
+            capacity = std::max(block, name.size());
+            blocks.emplace_back(new char[capacity]);
+            used = 0;
+        }
+        const auto p = blocks.back().get() + used;
+        name.copy(p, name.size());
+        used += name.size();
+        return {p, name.size()};
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::size_t used = 0;
+    std::size_t capacity = 0;
+
+    std::unordered_map<std::string_view, Symbol::Id> ids;
+    // Indexed by id, the entries of single byte names and the empty name are
+    // placeholders
+    Names names;
+    // Guards ids and the writes to names
+    mutable std::shared_mutex mutex;
+};
+
+Table & table()
+{
+    static Table table;
+    return table;
+}
+}  // namespace
+
+Symbol::Symbol(std::string_view name)
+    : value(name.empty()       ? empty
+            : name.size() == 1 ? static_cast<unsigned char>(name.front())
+                               : table().intern(name))
+{}
+
+std::string_view Symbol::str() const
+{
+    if (value < 256)
+        return {&characters[value], 1};
+    if (value == empty)
+        return {};
+    return table().str(value);
+}
+
+Symbol::Id Symbol::count()
+{
+    return table().count();
+}
+
+std::ostream & operator<<(std::ostream & os, Symbol symbol)
+{
+    return os << symbol.str();
+}
+}  // namespace mk
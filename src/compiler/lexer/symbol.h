@@ -0,0 +1,75 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace mk
+{
+// Interned name, equal names map to the same id for the whole process so that
+// names are compared, hashed and used as indices as plain integers. Ids are
+// dense: single byte names take the id of their byte and every other name is
+// numbered in the order it was first interned. Reading the text of a symbol
+// takes no lock. Interned names are never freed, memory grows with the number
+// of distinct names rather than with how often they are interned.
+class Symbol
+{
+public:
+    using Id = std::uint32_t;
+
+    // The empty name
+    constexpr Symbol() : value(empty) {}
+    constexpr explicit Symbol(unsigned char c) : value(c) {}
+    explicit Symbol(std::string_view name);
+
+    constexpr Id id() const { return value; }
+    std::string_view str() const;
+
+    // Upper bound of the ids handed out so far, meant for sizing tables
+    // indexed by id
+    static Id count();
+
+    constexpr bool operator==(const Symbol &) const = default;
+    bool operator==(std::string_view name) const { return str() == name; }
+
+private:
+    static constexpr Id empty = 256;
+
+    Id value;
+};
+
+std::ostream & operator<<(std::ostream & os, Symbol symbol);
+
+// Entry of a table indexed by Symbol::id, the table grows to cover every
+// symbol interned so far at once rather than one entry at a time
+template <typename T>
+T & at(std::vector<T> & table, Symbol name)
+{
+    if (table.size() <= name.id())
+        table.resize(std::max<std::size_t>(Symbol::count(), name.id() + 1));
+    return table[name.id()];
+}
+
+// Entry of a table of pointers indexed by Symbol::id, null past its end
+template <typename T>
+T lookup(const std::vector<T> & table, Symbol name)
+{
+    return name.id() < table.size() ? table[name.id()] : nullptr;
+}
+}  // namespace mk
+
+template <>
+struct std::hash<mk::Symbol>
+{
+    std::size_t operator()(mk::Symbol symbol) const noexcept
+    {
+        return symbol.id();
+    }
+};
+
+#endif
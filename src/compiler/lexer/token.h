@@ -1,8 +1,12 @@
 #ifndef __TOKEN_H__
 #define __TOKEN_H__
 
-#include <string>
+#include "keywords.h"
+#include "symbol.h"
+
+#include <cstddef>
 #include <string_view>
+#include <type_traits>
 #include <variant>
 
 namespace mk
@@ -25,12 +29,13 @@ struct Extern : TokenBase
 
 struct Identifier : TokenBase
 {
-    Identifier(std::string && value) : value(std::move(value)) {}
+    constexpr Identifier(Symbol value) : value(value) {}
+    Identifier(std::string_view value) : value(value) {}
     bool operator==(const Identifier & other) const
     {
         return value == other.value;
     }
-    std::string value;
+    Symbol value;
 };
 
 struct Literal : TokenBase
@@ -39,12 +44,17 @@ struct Literal : TokenBase
 
 struct Invalid : TokenBase
 {
-    Invalid(std::string && value) : value(std::move(value)) {}
+    constexpr Invalid(std::string_view value, std::size_t offset = 0)
+        : value(value), offset(offset)
+    {}
     bool operator==(const Invalid & other) const
     {
-        return value == other.value;
+        return value == other.value && offset == other.offset;
     }
-    std::string value;
+    // Diagnostic message
+    std::string_view value;
+    // Position of the offending text in the input of the Lexer
+    std::size_t offset;
 };
 
 struct Empty : TokenBase
@@ -94,10 +104,29 @@ struct Operator : TokenBase
     {
         return value == other.value;
     }
-    Operator(std::string && value) : value(std::move(value)) {}
-    std::string value;
+    constexpr Operator(Symbol value) : value(value) {}
+    Operator(std::string_view value) : value(value) {}
+    Symbol value;
 };
 
+// Introduces a user defined operator, the lexer consumes it together with the
+// operator that follows and yields an Operator token
+struct OperatorKeyword
+{
+    static constexpr const char * const value = "operator";
+};
+
+// Every keyword recognized by the lexer, new keywords are registered here
+using Keywords = KeywordTable<Def,
+                              Extern,
+                              If,
+                              Then,
+                              Else,
+                              For,
+                              In,
+                              Let,
+                              OperatorKeyword>;
+
 using TokenType = std::variant<Empty,
                                Def,
                                Extern,
@@ -112,6 +141,8 @@ using TokenType = std::variant<Empty,
                                double,
                                unsigned char,
                                Invalid>;
+// Names are interned and diagnostics are static, so tokens are cheap to copy
+// and do not borrow from the input of the Lexer
 struct Token : TokenType
 {
     using TokenType::variant;
@@ -130,6 +161,8 @@ struct Token : TokenType
         return std::holds_alternative<T>(static_cast<const TokenType &>(*this));
     }
 };
+
+static_assert(std::is_trivially_copyable_v<Token>);
 }  // namespace mk
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "token_stream.h"
+
+#include <algorithm>
+#include <type_traits>
+
+namespace mk
+{
+namespace
+{
+// Default constructs the alternative with the given index, used for the
+// kinds that carry no payload (Empty and keywords)
+template <std::size_t... I>
+Token make(std::size_t kind, std::index_sequence<I...>)
+{
+    Token token;
+    (
+        [&]
+        {
+            using T = std::variant_alternative_t<I, TokenType>;
+            if constexpr (std::is_empty_v<T>)
+                if (kind == I)
+                    token = T{};
+        }(),
+        ...);
+    return token;
+}
+}  // namespace
+
+Token TokenStream::operator[](std::size_t i) const
+{
+    if (i >= size())
+        return Empty{};
+
+    switch (kinds[i])
+    {
+    case TokenStream::kind<Identifier>():
+        return Identifier(symbols[i]);
+    case TokenStream::kind<Operator>():
+        return Operator(symbols[i]);
+    case TokenStream::kind<double>():
+        return values[i];
+    case TokenStream::kind<unsigned char>():
+        return static_cast<unsigned char>(source[offsets[i]]);
+    case TokenStream::kind<Invalid>():
+        return std::lower_bound(errors.cbegin(),
+                                errors.cend(),
+                                i,
+                                [](const auto & error, std::size_t i)
+                                { return error.first < i; })
+            ->second;
+    default:
+        return make(kinds[i],
+                    std::make_index_sequence<std::variant_size_v<TokenType>>{});
+    }
+}
+
+void TokenStream::push_back(const Token & token, std::string_view lexeme)
+{
+    Symbol symbol;
+    if (const auto p = std::get_if<Identifier>(&token))
+        symbol = p->value;
+    else if (const auto p = std::get_if<Operator>(&token))
+        symbol = p->value;
+    else if (const auto p = std::get_if<Invalid>(&token))
+        errors.emplace_back(size(), *p);
+
+    const auto p = std::get_if<double>(&token);
+
+    kinds.push_back(token.index());
+    offsets.push_back(lexeme.data() - source.data());
+    lengths.push_back(lexeme.size());
+    values.push_back(p ? *p : 0.0);
+    symbols.push_back(symbol);
+}
+
+void TokenStream::reserve(std::size_t n)
+{
+    kinds.reserve(n);
+    offsets.reserve(n);
+    lengths.reserve(n);
+    values.reserve(n);
+    symbols.reserve(n);
+}
+}  // namespace mk
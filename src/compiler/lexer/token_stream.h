@@ -0,0 +1,66 @@
+#ifndef __TOKEN_STREAM_H__
+#define __TOKEN_STREAM_H__
+
+#include "token.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mk
+{
+// Every token of an input laid out as a struct of arrays, produced in a single
+// pass by Lexer::tokenize. Tokens are addressed by index so that consumers can
+// look ahead freely, and the arrays can be cached or split independently of
+// the lexing that produced them. The stream borrows its text from source,
+// which Lexer::tokenize limits to 4 GiB so that offsets fit 32 bits.
+struct TokenStream
+{
+    TokenStream(std::string_view source = {}) : source(source) {}
+
+    // Entry of kinds for tokens of type T
+    template <typename T, std::size_t I = 0>
+    static constexpr std::uint8_t kind()
+    {
+        if constexpr (std::is_same_v<std::variant_alternative_t<I, TokenType>,
+                                     T>)
+            return I;
+        else
+            return kind<T, I + 1>();
+    }
+
+    std::size_t size() const { return kinds.size(); }
+    bool empty() const { return kinds.empty(); }
+
+    // Materializes the token at index i, or Empty past the end
+    Token operator[](std::size_t i) const;
+
+    // Source text the token at index i was lexed from
+    std::string_view text(std::size_t i) const
+    {
+        return source.substr(offsets[i], lengths[i]);
+    }
+
+    void push_back(const Token & token, std::string_view lexeme);
+    void reserve(std::size_t n);
+
+    std::string_view source;
+
+    // Token::index() of each token
+    std::vector<std::uint8_t> kinds;
+    // Position and length of the text of each token in source
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> lengths;
+    // Decoded value of each literal, unspecified for other kinds
+    std::vector<double> values;
+    // Name of each Identifier and Operator, unspecified for other kinds
+    std::vector<Symbol> symbols;
+    // Invalid tokens along with their index, sorted by index
+    std::vector<std::pair<std::uint32_t, Invalid>> errors;
+};
+}  // namespace mk
+
+#endif
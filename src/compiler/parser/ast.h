@@ -3,11 +3,15 @@
 
 #include "visitor.h"
 
+#include "compiler/lexer/symbol.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <optional>
-#include <shared_mutex>
-#include <string>
-#include <unordered_map>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace mk
@@ -15,35 +19,137 @@ namespace mk
 namespace ast
 {
 class Visitor;
+class Node;
+
+// Nodes are owned by the Arena they were made in and are never destroyed one
+// by one, so the pointers that link them do not delete
+struct Release
+{
+    void operator()(const Node *) const {}
+};
+
+template <typename T>
+using Ptr = std::unique_ptr<T, Release>;
+
+// Owns every node of a compilation unit along with their child vectors, all
+// of them are released at once when the arena is destroyed. Nodes must not
+// outlive it and only hold trivially destructible data or data allocated
+// from resource().
+class Arena
+{
+public:
+    Arena(std::size_t size = 64 * 1024) : buffer(size) {}
+
+    template <typename T, typename... Args>
+    Ptr<T> make(Args &&... args)
+    {
+        return Ptr<T>(new (buffer.allocate(sizeof(T), alignof(T)))
+                          T(std::forward<Args>(args)...));
+    }
+
+    std::pmr::memory_resource * resource() { return &buffer; }
+
+    // Copies text into the arena
+    std::string_view copy(std::string_view text)
+    {
+        const auto p = static_cast<char *>(buffer.allocate(text.size(), 1));
+        return {p, text.copy(p, text.size())};
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource buffer;
+};
+
+// Slot of a name that no binding in scope declares, see passes::Resolve
+constexpr std::uint32_t unresolved = ~std::uint32_t{0};
+
+// Relaxations of IEEE arithmetic that the code of a function may be optimized
+// with, LLVM's fast-math flags as a bit set. Set per compilation and per
+// definition with def [flag ...] name(...).
+enum class FastMath : std::uint8_t
+{
+    none = 0,
+    // Reassociate and distribute, which lets reductions vectorize
+    reassoc = 1 << 0,
+    // Fuse a multiplication and an addition into an FMA
+    contract = 1 << 1,
+    // Assume no NaN and no infinity, results are poison otherwise
+    nnan = 1 << 2,
+    ninf = 1 << 3,
+    // Ignore the sign of zeros
+    nsz = 1 << 4,
+    // Multiply by the reciprocal instead of dividing
+    arcp = 1 << 5,
+    // Approximate functions such as sin and sqrt
+    afn = 1 << 6,
+    fast = (1 << 7) - 1,
+};
+
+constexpr FastMath operator|(FastMath l, FastMath r)
+{
+    return static_cast<FastMath>(static_cast<std::uint8_t>(l)
+                                 | static_cast<std::uint8_t>(r));
+}
+
+constexpr bool operator&(FastMath l, FastMath r)
+{
+    return static_cast<std::uint8_t>(l) & static_cast<std::uint8_t>(r);
+}
+
+// Concrete type of a node, lets passes dispatch without virtual calls
+enum class Kind : std::uint8_t
+{
+    Variable,
+    Literal,
+    UnaryExpr,
+    BinExpr,
+    CallExpr,
+    ConditionalExpr,
+    ForExpr,
+    LetExpr,
+    ProtoType,
+    Function,
+    Extern,
+    Error,
+};
 
 class Node
 {
 public:
+    explicit Node(Kind kind) : kind(kind) {}
     virtual ~Node() = default;
     virtual void accept(Visitor & visitor) = 0;
     virtual void accept_children(Visitor & visitor) = 0;
+
+    const Kind kind;
+    // Whether the node may have several parents, see Sharing. Passes that
+    // rewrite a shared node in place rewrite every occurrence.
+    bool shared = false;
 };
 
 class Expr : public Node
 {
 public:
+    using Node::Node;
     ~Expr() override = default;
 };
 
 class Variable : public Expr
 {
 public:
-    Variable(std::string && name) : name(std::move(name)) {}
+    Variable(Symbol name) : Expr(Kind::Variable), name(name) {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
     void accept_children(Visitor & visitor) override {}
-    std::string name;
+    Symbol name;
+    // Slot of the binding the name refers to
+    std::uint32_t slot = unresolved;
 };
 
 class Literal : public Expr
 {
 public:
-    Literal(double value) : value(value) {}
+    Literal(double value) : Expr(Kind::Literal), value(value) {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
     void accept_children(Visitor & visitor) override {}
@@ -54,9 +160,9 @@ public:
 class LetExpr : public Expr
 {
 public:
-    LetExpr(std::vector<std::pair<std::string, std::unique_ptr<Expr>>> && vars,
-            std::unique_ptr<Expr> && body)
-        : vars(std::move(vars)), body(std::move(body))
+    LetExpr(std::pmr::vector<std::pair<Symbol, Ptr<Expr>>> && vars,
+            Ptr<Expr> && body)
+        : Expr(Kind::LetExpr), vars(std::move(vars)), body(std::move(body))
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -70,15 +176,17 @@ public:
             body->accept(visitor);
     }
 
-    std::vector<std::pair<std::string, std::unique_ptr<Expr>>> vars;
-    std::unique_ptr<Expr> body;
+    std::pmr::vector<std::pair<Symbol, Ptr<Expr>>> vars;
+    Ptr<Expr> body;
+    // Slot of the first binding, the others follow in order
+    std::uint32_t slot = unresolved;
 };
 
 class UnaryExpr : public Expr
 {
 public:
-    UnaryExpr(std::string && op, std::unique_ptr<Expr> && operand)
-        : op(std::move(op)), operand(std::move(operand))
+    UnaryExpr(Symbol op, Ptr<Expr> && operand)
+        : Expr(Kind::UnaryExpr), op(op), operand(std::move(operand))
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -89,17 +197,17 @@ public:
             operand->accept(visitor);
     }
 
-    std::string op;
-    std::unique_ptr<Expr> operand;
+    Symbol op;
+    Ptr<Expr> operand;
 };
 
 class BinExpr : public Expr
 {
 public:
-    BinExpr(std::string && op,
-            std::unique_ptr<Expr> && lhs,
-            std::unique_ptr<Expr> && rhs)
-        : op(std::move(op)), lhs(std::move(lhs)), rhs(std::move(rhs))
+    BinExpr(Symbol op,
+            Ptr<Expr> && lhs,
+            Ptr<Expr> && rhs)
+        : Expr(Kind::BinExpr), op(op), lhs(std::move(lhs)), rhs(std::move(rhs))
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -111,18 +219,19 @@ public:
             rhs->accept(visitor);
     }
 
-    std::string op;
-    std::unique_ptr<Expr> lhs;
-    std::unique_ptr<Expr> rhs;
+    Symbol op;
+    Ptr<Expr> lhs;
+    Ptr<Expr> rhs;
 };
 
 class ConditionalExpr : public Expr
 {
 public:
-    ConditionalExpr(std::unique_ptr<Expr> && condition,
-                    std::unique_ptr<Expr> && first,
-                    std::unique_ptr<Expr> && second)
-        : condition(std::move(condition))
+    ConditionalExpr(Ptr<Expr> && condition,
+                    Ptr<Expr> && first,
+                    Ptr<Expr> && second)
+        : Expr(Kind::ConditionalExpr)
+        , condition(std::move(condition))
         , first(std::move(first))
         , second(std::move(second))
     {}
@@ -139,20 +248,21 @@ public:
             second->accept(visitor);
     }
 
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Expr> first;
-    std::unique_ptr<Expr> second;
+    Ptr<Expr> condition;
+    Ptr<Expr> first;
+    Ptr<Expr> second;
 };
 
 class ForExpr : public Expr
 {
 public:
-    ForExpr(std::string && name,
-            std::unique_ptr<Expr> && init,
-            std::unique_ptr<Expr> && condition,
-            std::unique_ptr<Expr> && step,
-            std::unique_ptr<Expr> && body)
-        : name(std::move(name))
+    ForExpr(Symbol name,
+            Ptr<Expr> && init,
+            Ptr<Expr> && condition,
+            Ptr<Expr> && step,
+            Ptr<Expr> && body)
+        : Expr(Kind::ForExpr)
+        , name(name)
         , init(std::move(init))
         , condition(std::move(condition))
         , step(std::move(step))
@@ -173,18 +283,20 @@ public:
             body->accept(visitor);
     }
 
-    std::string name;
-    std::unique_ptr<Expr> init;
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Expr> step;
-    std::unique_ptr<Expr> body;
+    Symbol name;
+    Ptr<Expr> init;
+    Ptr<Expr> condition;
+    Ptr<Expr> step;
+    Ptr<Expr> body;
+    // Slot of the induction variable
+    std::uint32_t slot = unresolved;
 };
 
 class CallExpr : public Expr
 {
 public:
-    CallExpr(std::string && name, std::vector<std::unique_ptr<Expr>> && args)
-        : name(std::move(name)), args(std::move(args))
+    CallExpr(Symbol name, std::pmr::vector<Ptr<Expr>> && args)
+        : Expr(Kind::CallExpr), name(name), args(std::move(args))
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -198,15 +310,15 @@ public:
         }
     }
 
-    std::string name;
-    std::vector<std::unique_ptr<Expr>> args;
+    Symbol name;
+    std::pmr::vector<Ptr<Expr>> args;
 };
 
 class ProtoType : public Node
 {
 public:
-    ProtoType(std::string && name, std::vector<std::string> && args)
-        : name(std::move(name)), args(std::move(args))
+    ProtoType(Symbol name, std::pmr::vector<Symbol> && args)
+        : Node(Kind::ProtoType), name(name), args(std::move(args))
     {}
 
     ProtoType(ProtoType &&) = default;
@@ -214,15 +326,15 @@ public:
     void accept(Visitor & visitor) override { visitor.visit(*this); }
     void accept_children(Visitor & visitor) override {}
 
-    std::string name;
-    std::vector<std::string> args;
+    Symbol name;
+    std::pmr::vector<Symbol> args;
 };
 
 class Extern : public Node
 {
 public:
-    Extern(std::unique_ptr<ProtoType> && prototype)
-        : prototype(std::move(prototype))
+    Extern(Ptr<ProtoType> && prototype)
+        : Node(Kind::Extern), prototype(std::move(prototype))
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -231,16 +343,20 @@ public:
         if (prototype)
             prototype->accept(visitor);
     }
-    std::unique_ptr<ast::ProtoType> prototype;
+    Ptr<ProtoType> prototype;
 };
 
 
 class Function : public Node
 {
 public:
-    Function(std::unique_ptr<ProtoType> && prototype,
-             std::unique_ptr<Expr> && body)
-        : prototype(std::move(prototype)), body(std::move(body))
+    Function(Ptr<ProtoType> && prototype,
+             Ptr<Expr> && body,
+             FastMath math = FastMath::none)
+        : Node(Kind::Function)
+        , prototype(std::move(prototype))
+        , body(std::move(body))
+        , math(math)
     {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
@@ -251,19 +367,67 @@ public:
         if (body)
             body->accept(visitor);
     }
-    std::unique_ptr<ProtoType> prototype;
-    std::unique_ptr<Expr> body;
+    Ptr<ProtoType> prototype;
+    Ptr<Expr> body;
+    // Relaxations the definition asks for on top of those of the compilation
+    FastMath math;
 };
 
 class Error : public Node
 {
 public:
-    Error(const std::string & msg) : msg(msg) {}
+    // msg must outlive the node, it is either a string literal or a copy in
+    // the arena of the node
+    Error(std::string_view msg) : Node(Kind::Error), msg(msg) {}
 
     void accept(Visitor & visitor) override { visitor.visit(*this); }
     void accept_children(Visitor & visitor) override {}
 
-    std::string msg;
+    std::string_view msg;
+};
+
+// Statically dispatched alternative to Visitor. Derived provides a visit
+// overload for every node type and calls dispatch() where a Visitor would
+// call accept(): the switch on the node kind resolves to direct calls, which
+// the compiler can inline, instead of two virtual calls per node.
+template <typename Derived>
+class StaticVisitor
+{
+public:
+    void dispatch(Node & node)
+    {
+        auto & self = static_cast<Derived &>(*this);
+        switch (node.kind)
+        {
+        case Kind::Variable:
+            return self.visit(static_cast<Variable &>(node));
+        case Kind::Literal:
+            return self.visit(static_cast<Literal &>(node));
+        case Kind::UnaryExpr:
+            return self.visit(static_cast<UnaryExpr &>(node));
+        case Kind::BinExpr:
+            return self.visit(static_cast<BinExpr &>(node));
+        case Kind::CallExpr:
+            return self.visit(static_cast<CallExpr &>(node));
+        case Kind::ConditionalExpr:
+            return self.visit(static_cast<ConditionalExpr &>(node));
+        case Kind::ForExpr:
+            return self.visit(static_cast<ForExpr &>(node));
+        case Kind::LetExpr:
+            return self.visit(static_cast<LetExpr &>(node));
+        case Kind::ProtoType:
+            return self.visit(static_cast<ProtoType &>(node));
+        case Kind::Function:
+            return self.visit(static_cast<Function &>(node));
+        case Kind::Extern:
+            return self.visit(static_cast<Extern &>(node));
+        case Kind::Error:
+            return self.visit(static_cast<Error &>(node));
+        }
+    }
+
+protected:
+    ~StaticVisitor() = default;
 };
 
 }  // namespace ast
@@ -0,0 +1,159 @@
+#include "document.h"
+
+#include "lexer.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <utility>
+
+namespace mk
+{
+Document::Document(std::string text)
+    : source(std::move(text))
+    , chunks{{0, Parser::builtins(), 0, {}, nullptr}}
+{
+    reparse(0, 1, 0);
+}
+
+Document::Change Document::edit(std::size_t offset,
+                                 std::size_t length,
+                                 std::string_view replacement)
+{
+    assert(offset + length <= source.size());
+
+    // The chunk holding offset is parsed again, and so is the one before when
+    // the edit reaches into the def or extern starting it: the last item of
+    // that chunk may take in what is left of the keyword. Chunks that merely
+    // touch the edited range are parsed again as well, the tokens at their
+    // ends may merge with the new text.
+    auto first = std::ranges::upper_bound(chunks, offset, {}, &Chunk::begin)
+                 - chunks.cbegin() - 1;
+    if (first > 0)
+    {
+        Lexer lexer(source, chunks[first].begin);
+        lexer.next();
+        if (offset <= lexer.offset())
+            --first;
+    }
+    const auto last =
+        std::ranges::upper_bound(chunks, offset + length, {}, &Chunk::begin)
+        - chunks.cbegin();
+
+    source.replace(offset, length, replacement);
+    return reparse(first,
+                   last,
+                   static_cast<std::ptrdiff_t>(replacement.size())
+                       - static_cast<std::ptrdiff_t>(length));
+}
+
+std::vector<Diagnostic> Document::diagnostics() const
+{
+    std::vector<Diagnostic> diagnostics;
+    for (const auto & chunk : chunks)
+        diagnostics.insert(
+            diagnostics.end(), chunk.errors.cbegin(), chunk.errors.cend());
+    return diagnostics;
+}
+
+Document::Change
+Document::reparse(std::size_t first, std::size_t last, std::ptrdiff_t delta)
+{
+    const auto is_start = [](const Token & token)
+    { return token.is<Def>() || token.is<Extern>() || token.is<Empty>(); };
+
+    TokenStream tokens(source);
+    Lexer lexer(source, chunks[first].begin);
+    auto precedence = chunks[first].precedence;
+    const auto arena = std::make_shared<ast::Arena>(4096);
+
+    const auto push = [&]
+    {
+        tokens.push_back(lexer.current(), lexer.lexeme());
+        lexer.next();
+    };
+
+    std::vector<Chunk> fresh;
+    std::vector<ast::Ptr<ast::Node>> parsed;
+    auto next = first;
+    lexer.next();
+    if (!lexer.current().is<Empty>())
+        push();
+    while (true)
+    {
+        const auto begin = fresh.empty() ? 0 : tokens.size() - 1;
+        const std::size_t offset =
+            fresh.empty() ? chunks[first].begin : tokens.offsets[begin];
+        while (!is_start(lexer.current()))
+            push();
+
+        // The def or extern starting the next chunk is lexed before parsing,
+        // so that errors at the end of this one are reported at that token
+        // as by a parse of the whole text
+        const auto end = tokens.size();
+        const auto done = lexer.current().is<Empty>();
+        if (!done)
+            push();
+
+        Parser parser(nullptr,
+                      &tokens,
+                      begin,
+                      end,
+                      precedence,
+                      arena.get(),
+                      Parser::default_depth);
+        parser.parse();
+        fresh.push_back({offset,
+                         precedence,
+                         parser.root.size(),
+                         std::move(parser.errors),
+                         arena});
+        std::move(parser.root.begin(),
+                  parser.root.end(),
+                  std::back_inserter(parsed));
+        precedence = parser.precedence.snapshot();
+
+        if (done)
+        {
+            next = chunks.size();
+            break;
+        }
+
+        // Lexing from the start of an old chunk that follows the edit yields
+        // the tokens it was parsed from, and so does parsing them with the
+        // same precedences
+        const std::size_t position = tokens.offsets[end];
+        next = std::max(next, last);
+        while (next < chunks.size() && chunks[next].begin + delta < position)
+            ++next;
+        if (next < chunks.size() && chunks[next].begin + delta == position
+            && *chunks[next].precedence == *precedence)
+            break;
+    }
+
+    std::size_t at = 0;
+    for (std::size_t i = 0; i < first; ++i)
+        at += chunks[i].size;
+    std::size_t removed = 0;
+    for (std::size_t i = first; i < next; ++i)
+        removed += chunks[i].size;
+    for (std::size_t i = next; i < chunks.size(); ++i)
+    {
+        chunks[i].begin += delta;
+        for (auto & error : chunks[i].errors)
+            error.offset += delta;
+    }
+
+    items.erase(items.begin() + at, items.begin() + at + removed);
+    items.insert(items.begin() + at,
+                 std::make_move_iterator(parsed.begin()),
+                 std::make_move_iterator(parsed.end()));
+    chunks.erase(chunks.begin() + first, chunks.begin() + next);
+    chunks.insert(chunks.begin() + first,
+                  std::make_move_iterator(fresh.begin()),
+                  std::make_move_iterator(fresh.end()));
+
+    return {at, removed, parsed.size()};
+}
+}  // namespace mk
@@ -0,0 +1,74 @@
+#ifndef __DOCUMENT_H__
+#define __DOCUMENT_H__
+
+#include "ast.h"
+#include "parser.h"
+#include "precedence.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mk
+{
+// A source text that stays parsed across edits, for interactive tools.
+//
+// The text is split into chunks that start at a def or an extern, which the
+// parser never consumes below the top level. An edit re-lexes and re-parses
+// the chunks it touches, then the following ones until lexing resynchronizes
+// at the start of an old chunk with the precedences that chunk was parsed
+// with. The nodes of every other chunk are kept as they are.
+class Document
+{
+public:
+    // The items root()[first, first + inserted) replaced the items that were
+    // at root()[first, first + removed) before an edit
+    struct Change
+    {
+        std::size_t first;
+        std::size_t removed;
+        std::size_t inserted;
+    };
+
+    Document(std::string text);
+
+    // Replaces the length characters at offset with replacement
+    Change
+    edit(std::size_t offset, std::size_t length, std::string_view replacement);
+
+    const std::string & text() const { return source; }
+
+    // Same as Parser::parse() over text()
+    const std::vector<ast::Ptr<ast::Node>> & root() const { return items; }
+    // Same as Parser::diagnostics() over text()
+    std::vector<Diagnostic> diagnostics() const;
+
+private:
+    struct Chunk
+    {
+        // Position in the text of the def or extern starting the chunk, 0 for
+        // the first one
+        std::size_t begin;
+        // Precedences in effect at begin
+        Precedence::Snapshot precedence;
+        // Number of top level items parsed from the chunk
+        std::size_t size;
+        std::vector<Diagnostic> errors;
+        // Owns the nodes of the items, shared by the chunks parsed together
+        std::shared_ptr<ast::Arena> arena;
+    };
+
+    // Parses the chunks [first, last) again along with as many following ones
+    // as needed, the text of first must start where it used to and the text
+    // of the chunks from last on moved by delta
+    Change reparse(std::size_t first, std::size_t last, std::ptrdiff_t delta);
+
+    std::string source;
+    std::vector<Chunk> chunks;
+    std::vector<ast::Ptr<ast::Node>> items;
+};
+}  // namespace mk
+
+#endif
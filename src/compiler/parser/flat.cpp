@@ -0,0 +1,361 @@
+#include "flat.h"
+
+#include "visitor.h"
+
+#include <cassert>
+
+namespace mk
+{
+namespace ast
+{
+namespace flat
+{
+namespace
+{
+class Builder final : private Visitor
+{
+public:
+    Builder(Tree & tree) : tree(tree) {}
+
+    void operator()(const std::vector<Ptr<ast::Node>> & root)
+    {
+        for (const auto & node : root)
+        {
+            child(node.get());
+            tree.roots.push_back(stack.back());
+            stack.pop_back();
+        }
+    }
+
+private:
+    // Flattens node and pushes its index on the stack of pending children
+    void child(ast::Node * node)
+    {
+        if (node)
+            node->accept(*this);
+        else
+            last = none;
+        stack.push_back(last);
+    }
+
+    // Appends a node whose children are the entries of the stack from base
+    void push(Kind kind,
+              Symbol name,
+              std::size_t base,
+              std::uint8_t flags = 0)
+    {
+        const Node node{
+            .kind = kind,
+            .flags = flags,
+            .name = name,
+            .first = static_cast<std::uint32_t>(tree.children.size()),
+            .count = static_cast<std::uint32_t>(stack.size() - base)};
+        tree.children.insert(tree.children.end(),
+                             stack.cbegin() + base,
+                             stack.cend());
+        stack.resize(base);
+
+        last = tree.nodes.size();
+        tree.nodes.push_back(node);
+    }
+
+    void visit(Variable & variable) override
+    {
+        push(Kind::Variable, variable.name, stack.size());
+    }
+
+    void visit(Literal & literal) override
+    {
+        last = tree.nodes.size();
+        tree.nodes.push_back(
+            {.kind = Kind::Literal,
+             .first = static_cast<std::uint32_t>(tree.literals.size())});
+        tree.literals.push_back(literal.value);
+    }
+
+    void visit(UnaryExpr & unary) override
+    {
+        const auto base = stack.size();
+        child(unary.operand.get());
+        push(Kind::UnaryExpr, unary.op, base);
+    }
+
+    void visit(BinExpr & bin) override
+    {
+        const auto base = stack.size();
+        child(bin.lhs.get());
+        child(bin.rhs.get());
+        push(Kind::BinExpr, bin.op, base);
+    }
+
+    void visit(CallExpr & call) override
+    {
+        const auto base = stack.size();
+        for (const auto & arg : call.args)
+            child(arg.get());
+        push(Kind::CallExpr, call.name, base);
+    }
+
+    void visit(ConditionalExpr & conditional) override
+    {
+        const auto base = stack.size();
+        child(conditional.condition.get());
+        child(conditional.first.get());
+        child(conditional.second.get());
+        push(Kind::ConditionalExpr, {}, base);
+    }
+
+    void visit(ForExpr & f) override
+    {
+        const auto base = stack.size();
+        child(f.init.get());
+        child(f.condition.get());
+        child(f.step.get());
+        child(f.body.get());
+        push(Kind::ForExpr, f.name, base);
+    }
+
+    void visit(LetExpr & let) override
+    {
+        const auto base = stack.size();
+        for (const auto & [name, value] : let.vars)
+        {
+            const auto binding = stack.size();
+            child(value.get());
+            push(Kind::Binding, name, binding);
+            stack.push_back(last);
+        }
+        child(let.body.get());
+        push(Kind::LetExpr, {}, base);
+    }
+
+    void visit(ProtoType & prototype) override
+    {
+        const auto base = stack.size();
+        for (const auto arg : prototype.args)
+        {
+            push(Kind::Param, arg, stack.size());
+            stack.push_back(last);
+        }
+        push(Kind::ProtoType, prototype.name, base);
+    }
+
+    void visit(Function & function) override
+    {
+        const auto base = stack.size();
+        child(function.prototype.get());
+        child(function.body.get());
+        push(Kind::Function,
+             {},
+             base,
+             static_cast<std::uint8_t>(function.math));
+    }
+
+    void visit(Extern & e) override
+    {
+        const auto base = stack.size();
+        child(e.prototype.get());
+        push(Kind::Extern, {}, base);
+    }
+
+    void visit(Error & error) override
+    {
+        last = tree.nodes.size();
+        tree.nodes.push_back(
+            {.kind = Kind::Error,
+             .first = static_cast<std::uint32_t>(tree.errors.size())});
+        tree.errors.push_back(error.msg);
+    }
+
+    Tree & tree;
+    // Indices of the children flattened so far whose parent is pending
+    std::vector<std::uint32_t> stack;
+    // Index of the node flattened last
+    std::uint32_t last = none;
+};
+}  // namespace
+
+std::string_view to_string(Kind kind)
+{
+    switch (kind)
+    {
+    case Kind::Variable:
+        return "Variable";
+    case Kind::Literal:
+        return "Literal";
+    case Kind::UnaryExpr:
+        return "UnaryExpr";
+    case Kind::BinExpr:
+        return "BinExpr";
+    case Kind::CallExpr:
+        return "CallExpr";
+    case Kind::ConditionalExpr:
+        return "ConditionalExpr";
+    case Kind::ForExpr:
+        return "ForExpr";
+    case Kind::LetExpr:
+        return "LetExpr";
+    case Kind::Binding:
+        return "Binding";
+    case Kind::ProtoType:
+        return "ProtoType";
+    case Kind::Param:
+        return "Param";
+    case Kind::Function:
+        return "Function";
+    case Kind::Extern:
+        return "Extern";
+    case Kind::Error:
+        return "Error";
+    }
+    return {};
+}
+
+Tree flatten(const std::vector<Ptr<ast::Node>> & root)
+{
+    Tree tree;
+    Builder{tree}(root);
+    return tree;
+}
+
+std::vector<Ptr<ast::Node>> unflatten(const Tree & tree, Arena & arena)
+{
+    // Node made for each index until its parent takes it, bindings hold their
+    // value and parameters nothing
+    std::vector<Ptr<ast::Node>> made(tree.nodes.size());
+    const auto expr = [&](std::uint32_t i)
+    {
+        if (i == none)
+            return Ptr<Expr>();
+        return Ptr<Expr>(static_cast<Expr *>(made[i].release()));
+    };
+    const auto prototype = [&](std::uint32_t i)
+    {
+        if (i == none)
+            return Ptr<ProtoType>();
+        return Ptr<ProtoType>(static_cast<ProtoType *>(made[i].release()));
+    };
+
+    for (std::uint32_t i = 0; i < tree.nodes.size(); ++i)
+    {
+        const auto & node = tree.nodes[i];
+        const auto children = tree.children_of(i);
+        switch (node.kind)
+        {
+        case Kind::Variable:
+            made[i] = arena.make<Variable>(node.name);
+            break;
+        case Kind::Literal:
+            made[i] = arena.make<Literal>(tree.literal(i));
+            break;
+        case Kind::UnaryExpr:
+            made[i] = arena.make<UnaryExpr>(node.name, expr(children[0]));
+            break;
+        case Kind::BinExpr:
+            made[i] = arena.make<BinExpr>(
+                node.name, expr(children[0]), expr(children[1]));
+            break;
+        case Kind::CallExpr:
+        {
+            std::pmr::vector<Ptr<Expr>> args(arena.resource());
+            args.reserve(children.size());
+            for (const auto child : children)
+                args.push_back(expr(child));
+            made[i] = arena.make<CallExpr>(node.name, std::move(args));
+            break;
+        }
+        case Kind::ConditionalExpr:
+            made[i] = arena.make<ConditionalExpr>(
+                expr(children[0]), expr(children[1]), expr(children[2]));
+            break;
+        case Kind::ForExpr:
+            made[i] = arena.make<ForExpr>(node.name,
+                                          expr(children[0]),
+                                          expr(children[1]),
+                                          expr(children[2]),
+                                          expr(children[3]));
+            break;
+        case Kind::LetExpr:
+        {
+            std::pmr::vector<std::pair<Symbol, Ptr<Expr>>> vars(
+                arena.resource());
+            vars.reserve(children.size() - 1);
+            for (const auto child : children.first(children.size() - 1))
+                vars.emplace_back(tree.nodes[child].name, expr(child));
+            made[i] =
+                arena.make<LetExpr>(std::move(vars), expr(children.back()));
+            break;
+        }
+        case Kind::Binding:
+            made[i] = expr(children[0]);
+            break;
+        case Kind::ProtoType:
+        {
+            std::pmr::vector<Symbol> args(arena.resource());
+            args.reserve(children.size());
+            for (const auto child : children)
+                args.push_back(tree.nodes[child].name);
+            made[i] = arena.make<ProtoType>(node.name, std::move(args));
+            break;
+        }
+        case Kind::Param:
+            break;
+        case Kind::Function:
+            made[i] =
+                arena.make<Function>(prototype(children[0]),
+                                     expr(children[1]),
+                                     static_cast<FastMath>(node.flags));
+            break;
+        case Kind::Extern:
+            made[i] = arena.make<Extern>(prototype(children[0]));
+            break;
+        case Kind::Error:
+            made[i] = arena.make<Error>(arena.copy(tree.error(i)));
+            break;
+        }
+    }
+
+    std::vector<Ptr<ast::Node>> root;
+    root.reserve(tree.roots.size());
+    // Items that are none stay null like missing children
+    for (const auto i : tree.roots)
+    {
+        assert(i == none || i < made.size());
+        root.push_back(i == none ? Ptr<ast::Node>() : std::move(made[i]));
+    }
+    return root;
+}
+
+std::ostream & operator<<(std::ostream & os, const Tree & tree)
+{
+    for (std::uint32_t i = 0; i < tree.nodes.size(); ++i)
+    {
+        const auto & node = tree.nodes[i];
+        os << i << ": " << to_string(node.kind);
+        if (node.kind == Kind::Literal)
+            os << " " << tree.literal(i);
+        else if (node.kind == Kind::Error)
+            os << " " << tree.error(i);
+        else if (node.name != Symbol())
+            os << " " << node.name;
+        if (node.flags)
+            os << " [" << static_cast<unsigned>(node.flags) << "]";
+
+        for (const auto child : tree.children_of(i))
+        {
+            if (child == none)
+                os << " -";
+            else
+                os << " " << child;
+        }
+        os << "\n";
+    }
+
+    os << "roots:";
+    for (const auto root : tree.roots)
+        os << " " << root;
+    return os << "\n";
+}
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
@@ -0,0 +1,121 @@
+#ifndef __FLAT_H__
+#define __FLAT_H__
+
+#include "ast.h"
+
+#include "compiler/lexer/symbol.h"
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mk
+{
+namespace ast
+{
+namespace flat
+{
+enum class Kind : std::uint8_t
+{
+    // children: none
+    Variable,
+    // children: none, value in Tree::literals
+    Literal,
+    // children: operand
+    UnaryExpr,
+    // children: lhs, rhs
+    BinExpr,
+    // children: args...
+    CallExpr,
+    // children: condition, first, second
+    ConditionalExpr,
+    // children: init, condition, step, body
+    ForExpr,
+    // children: Binding..., body
+    LetExpr,
+    // A variable of a LetExpr, children: value
+    Binding,
+    // children: Param...
+    ProtoType,
+    // A parameter of a ProtoType, children: none
+    Param,
+    // children: prototype, body
+    Function,
+    // children: prototype
+    Extern,
+    // children: none, message in Tree::errors
+    Error,
+};
+
+std::string_view to_string(Kind kind);
+
+// Stands for a child the parser could not produce
+constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+struct Node
+{
+    Kind kind;
+    // ast::FastMath of a Function, 0 for other kinds
+    std::uint8_t flags = 0;
+    // Name of variables, calls, bindings, parameters and prototypes, operator
+    // of unary and binary expressions
+    Symbol name;
+    // The children are Tree::children[first, first + count), Literal and
+    // Error nodes index Tree::literals and Tree::errors with first instead
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+};
+
+// The AST laid out contiguously in post-order: children always come before
+// their parent, so a plain loop over nodes is a bottom up traversal that
+// needs neither recursion nor virtual calls. Nodes refer to each other by
+// index, which keeps the tree position independent for serialization and
+// hashing.
+struct Tree
+{
+    std::span<const std::uint32_t> children_of(std::uint32_t i) const
+    {
+        const auto & node = nodes[i];
+        if (!node.count)
+            return {};
+        return {children.data() + node.first, node.count};
+    }
+
+    // Nodes [first, last) of the k-th top level item, every item is a
+    // contiguous range ending with its root so that items can be processed
+    // independently of each other
+    std::pair<std::uint32_t, std::uint32_t> item(std::size_t k) const
+    {
+        return {k ? roots[k - 1] + 1 : 0, roots[k] + 1};
+    }
+
+    double literal(std::uint32_t i) const { return literals[nodes[i].first]; }
+    std::string_view error(std::uint32_t i) const
+    {
+        return errors[nodes[i].first];
+    }
+
+    std::vector<Node> nodes;
+    std::vector<std::uint32_t> children;
+    std::vector<double> literals;
+    std::vector<std::string_view> errors;
+    // Top level items in source order
+    std::vector<std::uint32_t> roots;
+};
+
+Tree flatten(const std::vector<Ptr<ast::Node>> & root);
+
+// Makes the nodes of tree in arena again, the inverse of flatten()
+std::vector<Ptr<ast::Node>> unflatten(const Tree & tree, Arena & arena);
+
+// One node per line along with its children, meant for debugging
+std::ostream & operator<<(std::ostream & os, const Tree & tree);
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
+
+#endif
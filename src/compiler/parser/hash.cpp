@@ -0,0 +1,55 @@
+#include "hash.h"
+
+#include "serialize.h"
+
+namespace mk
+{
+namespace ast
+{
+namespace flat
+{
+std::vector<std::uint64_t> hashes(const Tree & tree)
+{
+    // Hashes of the names by Symbol::id(), each text is hashed once
+    std::vector<std::uint64_t> names(Symbol::count());
+    std::vector<bool> hashed(names.size());
+
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(tree.nodes.size());
+    for (std::uint32_t i = 0; i < tree.nodes.size(); ++i)
+    {
+        const auto & node = tree.nodes[i];
+        // Only functions have flags
+        auto hash =
+            combine(0,
+                    static_cast<std::uint64_t>(node.kind)
+                        | std::uint64_t{node.flags} << 8);
+        if (node.kind == Kind::Literal)
+        {
+            hash = combine(hash, std::bit_cast<std::uint64_t>(tree.literal(i)));
+        }
+        else if (node.kind == Kind::Error)
+        {
+            hash = combine(hash, fingerprint(tree.error(i)));
+        }
+        else
+        {
+            const auto id = node.name.id();
+            if (!hashed[id])
+            {
+                names[id] = fingerprint(node.name.str());
+                hashed[id] = true;
+            }
+            hash = combine(hash, names[id]);
+        }
+
+        hash = combine(hash, node.count);
+        for (const auto child : tree.children_of(i))
+            hash = combine(hash, child == none ? 0 : hashes[child]);
+        hashes.push_back(avalanche(hash));
+    }
+    return hashes;
+}
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
@@ -0,0 +1,42 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "flat.h"
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace mk
+{
+namespace ast
+{
+// Mixes value into hash, the result depends on the order of the values
+constexpr std::uint64_t combine(std::uint64_t hash, std::uint64_t value)
+{
+    return (std::rotl(hash, 5) ^ value) * 0x9e3779b97f4a7c15;
+}
+
+// Final mix of MurmurHash3, every bit of hash flips about half of the bits of
+// the result
+constexpr std::uint64_t avalanche(std::uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    return hash ^ (hash >> 33);
+}
+
+namespace flat
+{
+// Structural hash of the subtree of every node of tree. Equal subtrees hash
+// alike in every process and on every host since names are hashed by text
+// rather than by symbol id, so the hash of the root of an item can key work
+// memoized across runs such as its code generation.
+std::vector<std::uint64_t> hashes(const Tree & tree);
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
+
+#endif
@@ -2,103 +2,251 @@
 
 #include "ast.h"
 #include "lexer.h"
+#include "scan.h"
 #include "util/overload.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <iterator>
 #include <optional>
+#include <string_view>
+#include <thread>
+#include <utility>
 
 
 namespace mk
 {
+namespace
+{
+// Reads the attributes of a def one token at a time, after the opening '['.
+// parse_def and the scan of parse_parallel for operator precedences both go
+// through it, so that they agree on where the prototype starts.
+class Attributes
+{
+public:
+    enum Step
+    {
+        more,
+        done,
+        failed,
+    };
 
-Parser::Parser(Lexer & lexer)
-    : lexer(lexer)
-    , precedence({
-          {"=", 2},
-          {"<", 10},
-          {"+", 20},
-          {"-", 20},
-          {"*", 40},
-      })
-{}
+    // Takes the next token, done on the closing ']'
+    Step feed(const Token & token)
+    {
+        static constexpr std::pair<std::string_view, ast::FastMath> flags[] = {
+            {"fast", ast::FastMath::fast},
+            {"reassoc", ast::FastMath::reassoc},
+            {"contract", ast::FastMath::contract},
+            {"nnan", ast::FastMath::nnan},
+            {"ninf", ast::FastMath::ninf},
+            {"nsz", ast::FastMath::nsz},
+            {"arcp", ast::FastMath::arcp},
+            {"afn", ast::FastMath::afn},
+        };
+
+        if (token.is(']'))
+            return done;
+        // A flag may be followed by a comma
+        if (std::exchange(comma, false) && token.is(','))
+            return more;
+
+        const auto p = std::get_if<Identifier>(&token);
+        const auto flag = std::ranges::find_if(
+            flags,
+            [&](const auto & flag) { return p && p->value == flag.first; });
+        if (flag == std::ranges::end(flags))
+            return failed;
+        math = math | flag->second;
+        comma = true;
+        return more;
+    }
 
-void Parser::Precedence::push(const std::string & op, std::int64_t value)
+    ast::FastMath math = ast::FastMath::none;
+
+private:
+    bool comma = false;
+};
+
+// Index of the token right past the attributes of the def at def, where its
+// prototype starts. End when the attributes are broken and parse_def stops
+// before the prototype.
+std::size_t
+prototype(const TokenStream & tokens, std::size_t def, std::size_t end)
 {
-    std::lock_guard lock(mutex);
-    map.emplace(op, value);
+    auto i = def + 1;
+    if (i == end || !tokens[i].is('['))
+        return i;
+
+    Attributes attributes;
+    while (++i < end)
+    {
+        switch (attributes.feed(tokens[i]))
+        {
+        case Attributes::more:
+            break;
+        case Attributes::done:
+            return i + 1;
+        case Attributes::failed:
+            return end;
+        }
+    }
+    return end;
 }
+}  // namespace
 
-std::optional<std::int64_t>
-Parser::Precedence::get(const std::optional<std::string> & op) const
+Precedence::Snapshot Parser::builtins()
 {
-    if (!op)
-        return std::nullopt;
+    static const Precedence builtins({
+        {Symbol('='), 2},
+        {Symbol('<'), 10},
+        {Symbol('+'), 20},
+        {Symbol('-'), 20},
+        {Symbol('*'), 40},
+    });
+    return builtins.snapshot();
+}
+
+Parser::Parser(Lexer & lexer, std::size_t limit)
+    : Parser(&lexer, nullptr, 0, 0, builtins(), nullptr, limit)
+{}
+
+Parser::Parser(const TokenStream & tokens, std::size_t limit)
+    : Parser(nullptr, &tokens, 0, tokens.size(), builtins(), nullptr, limit)
+{}
 
-    std::shared_lock lock(mutex);
-    if (const auto it = map.find(*op); it != map.cend())
-        return it->second;
-    return std::nullopt;
+Parser::Parser(Lexer * lexer,
+               const TokenStream * tokens,
+               std::size_t begin,
+               std::size_t end,
+               const Precedence::Snapshot & precedence,
+               ast::Arena * arena,
+               std::size_t limit)
+    : arena(arena)
+    , lexer(lexer)
+    , tokens(tokens)
+    , index(begin)
+    , end(end)
+    , precedence(precedence)
+    , limit(limit)
+{
+    if (!arena)
+        this->arena = arenas.emplace_back(std::make_unique<ast::Arena>()).get();
 }
 
-std::optional<std::string> Parser::parse_bin_op()
+void Parser::next()
 {
-    std::optional<std::string> op;
-    if (const auto p = std::get_if<unsigned char>(&lexer.current()))
+    if (tokens)
     {
-        op = std::string(1, *p);
+        if (index < end)
+            position = tokens->offsets[index];
+        else if (end < tokens->size())
+            position = tokens->offsets[end];
+        else
+            position = tokens->source.size();
+        token = index < end ? (*tokens)[index++] : Token(Empty{});
     }
-    else if (const auto p = std::get_if<Identifier>(&lexer.current()))
+    else
     {
-        op = p->value;
+        lexer->next();
+        token = lexer->current();
+        position = lexer->offset() - lexer->lexeme().size();
     }
+}
 
-    return op;
+const Token & Parser::current() const
+{
+    return token;
 }
 
-std::unique_ptr<ast::Expr>
-Parser::parse_bin_expr_rhs(std::int64_t previous,
-                           std::unique_ptr<ast::Expr> && lhs)
+void Parser::error(std::string message)
 {
-    while (true)
-    {
-        auto current = parse_bin_op();
+    if (std::exchange(panic, true))
+        return;
 
-        if (precedence.get(current) < previous)
-            return std::move(lhs);
+    if (const auto p = std::get_if<Invalid>(&current()))
+        errors.push_back({p->offset, std::string(p->value)});
+    else
+        errors.push_back({position, std::move(message)});
+}
 
-        lexer.next();
+const std::vector<Diagnostic> & Parser::diagnostics() const
+{
+    return errors;
+}
 
-        auto rhs = parse_unary_expr();
+Parsed Parser::release() &&
+{
+    return {std::move(arenas), std::move(root)};
+}
 
-        auto next = parse_bin_op();
+void Parser::share()
+{
+    if (table)
+        return;
+    tables.push_back(std::make_unique<ast::Sharing>(*arena));
+    table = tables.back().get();
+}
 
-        if (precedence.get(next) > precedence.get(current))
-        {
-            rhs = parse_bin_expr_rhs(*precedence.get(current) + 1,
-                                     std::move(rhs));
-        }
-        lhs = std::make_unique<ast::BinExpr>(std::move(*current),
-                                             std::move(lhs),
-                                             std::move(rhs));
+ast::Sharing::Report Parser::sharing() const
+{
+    ast::Sharing::Report report;
+    for (const auto & table : tables)
+        report += table->report();
+    return report;
+}
+
+ast::Ptr<ast::Expr> Parser::make_unary(Symbol op,
+                                       ast::Ptr<ast::Expr> && operand)
+{
+    if (table)
+        return table->unary(op, std::move(operand));
+    return arena->make<ast::UnaryExpr>(op, std::move(operand));
+}
+
+ast::Ptr<ast::Expr> Parser::make_binary(Symbol op,
+                                        ast::Ptr<ast::Expr> && lhs,
+                                        ast::Ptr<ast::Expr> && rhs)
+{
+    if (table)
+        return table->binary(op, std::move(lhs), std::move(rhs));
+    return arena->make<ast::BinExpr>(op, std::move(lhs), std::move(rhs));
+}
+
+std::optional<Symbol> Parser::parse_bin_op()
+{
+    std::optional<Symbol> op;
+    if (const auto p = std::get_if<unsigned char>(&current()))
+    {
+        op = Symbol(*p);
+    }
+    else if (const auto p = std::get_if<Identifier>(&current()))
+    {
+        op = p->value;
     }
+
+    return op;
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_call_expr(std::string && name)
+ast::Ptr<ast::Expr> Parser::parse_call_expr(Symbol name)
 {
-    std::vector<std::unique_ptr<ast::Expr>> args;
+    std::pmr::vector<ast::Ptr<ast::Expr>> args(arena->resource());
     while (true)
     {
-        if (lexer.current().is(')'))
+        if (current().is(')'))
         {
-            lexer.next();
-            return std::make_unique<ast::CallExpr>(std::move(name),
-                                                   std::move(args));
+            next();
+            if (table)
+                return table->call(name, std::move(args));
+            return arena->make<ast::CallExpr>(name, std::move(args));
         }
         else if (auto arg = parse_expr())
         {
             args.emplace_back(std::move(arg));
-            if (lexer.current().is(','))
+            if (current().is(','))
             {
-                lexer.next();
+                next();
             }
         }
         else
@@ -109,275 +257,529 @@ std::unique_ptr<ast::Expr> Parser::parse_call_expr(std::string && name)
     return nullptr;
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_identifier_expr(std::string && name)
+ast::Ptr<ast::Expr> Parser::parse_identifier_expr(Symbol name)
 {
-    if (lexer.current().is('('))
+    if (current().is('('))
     {
-        lexer.next();
-        return parse_call_expr(std::move(name));
+        next();
+        return parse_call_expr(name);
     }
     else
     {
-        return std::make_unique<ast::Variable>(std::move(name));
+        return arena->make<ast::Variable>(name);
     }
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_literal_expr(double value)
+ast::Ptr<ast::Expr> Parser::parse_literal_expr(double value)
 {
-    return std::make_unique<ast::Literal>(value);
+    if (table)
+        return table->literal(value);
+    return arena->make<ast::Literal>(value);
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_primary_expr()
+ast::Ptr<ast::Expr> Parser::parse_primary_expr()
 {
-    if (lexer.current().is('('))
-    {
-        lexer.next();
-        auto expr = parse_expr();
-        if (lexer.current().is(')'))
-        {
-            lexer.next();
-            return expr;
-        }
-        return nullptr;
-    }
-    else if (const auto p = std::get_if<double>(&lexer.current()))
+    if (const auto p = std::get_if<double>(&current()))
     {
         auto value = *p;
-        lexer.next();
+        next();
         return parse_literal_expr(std::move(value));
     }
-    else if (const auto p = std::get_if<Identifier>(&lexer.current()))
+    else if (const auto p = std::get_if<Identifier>(&current()))
     {
-        auto name = p->value;
-        lexer.next();
-        return parse_identifier_expr(std::move(name));
+        const auto name = p->value;
+        next();
+        return parse_identifier_expr(name);
     }
-    else if (lexer.current().is<If>())
+    else if (current().is<If>())
     {
-        lexer.next();
-        if (lexer.current().is('('))
+        next();
+        if (!current().is('('))
         {
-            lexer.next();
-            auto condition = parse_expr();
-            if (lexer.current().is(')'))
-            {
-                lexer.next();
-                if (lexer.current().is<Then>())
-                {
-                    lexer.next();
-                    auto first = parse_expr();
-                    if (lexer.current().is<Else>())
-                    {
-                        lexer.next();
-                        auto second = parse_expr();
-
-                        return std::make_unique<ast::ConditionalExpr>(
-                            std::move(condition),
-                            std::move(first),
-                            std::move(second));
-                    }
-                }
-            }
+            error("expected '(' after if");
+            return nullptr;
         }
-        return nullptr;
+        next();
+        auto condition = parse_expr();
+        if (!current().is(')'))
+        {
+            error("expected ')'");
+            return nullptr;
+        }
+        next();
+        if (!current().is<Then>())
+        {
+            error("expected then");
+            return nullptr;
+        }
+        next();
+        auto first = parse_expr();
+        if (!current().is<Else>())
+        {
+            error("expected else");
+            return nullptr;
+        }
+        next();
+        auto second = parse_expr();
+
+        if (table)
+            return table->conditional(
+                std::move(condition), std::move(first), std::move(second));
+        return arena->make<ast::ConditionalExpr>(
+            std::move(condition), std::move(first), std::move(second));
     }
-    else if (lexer.current().is<For>())
+    else if (current().is<For>())
     {
-        lexer.next();
-        if (const auto p = std::get_if<Identifier>(&lexer.current()))
+        next();
+        const auto p = std::get_if<Identifier>(&current());
+        if (!p)
         {
-            auto name = p->value;
-            lexer.next();
-            if (lexer.current().is('='))
-            {
-                lexer.next();
-                auto init = parse_expr();
-                if (lexer.current().is(','))
-                {
-                    lexer.next();
-                    auto condition = parse_expr();
+            error("expected a variable after for");
+            return nullptr;
+        }
+        const auto name = p->value;
+        next();
+        if (!current().is('='))
+        {
+            error("expected '='");
+            return nullptr;
+        }
+        next();
+        auto init = parse_expr();
+        if (!current().is(','))
+        {
+            error("expected ','");
+            return nullptr;
+        }
+        next();
+        auto condition = parse_expr();
 
-                    std::unique_ptr<ast::Expr> step;
-                    if (lexer.current().is(','))
-                    {
-                        lexer.next();
-                        step = parse_expr();
-                    }
+        ast::Ptr<ast::Expr> step;
+        if (current().is(','))
+        {
+            next();
+            step = parse_expr();
+        }
 
-                    if (lexer.current().is<In>())
-                    {
-                        lexer.next();
-                        auto body = parse_expr();
-                        return std::make_unique<ast::ForExpr>(std::move(name),
-                                                              std::move(init),
-                                                              std::move(
-                                                                  condition),
-                                                              std::move(step),
-                                                              std::move(body));
-                    }
-                }
-            }
+        if (!current().is<In>())
+        {
+            error("expected in");
+            return nullptr;
         }
-        return nullptr;
+        next();
+        auto body = parse_expr();
+        return arena->make<ast::ForExpr>(name,
+                                        std::move(init),
+                                        std::move(condition),
+                                        std::move(step),
+                                        std::move(body));
     }
-    else if (lexer.current().is<Let>())
+    else if (current().is<Let>())
     {
-        lexer.next();
-        std::vector<std::pair<std::string, std::unique_ptr<ast::Expr>>> vars;
-        while (const auto p = std::get_if<Identifier>(&lexer.current()))
+        next();
+        std::pmr::vector<std::pair<Symbol, ast::Ptr<ast::Expr>>> vars(
+            arena->resource());
+        while (const auto p = std::get_if<Identifier>(&current()))
         {
-            auto name = p->value;
-            lexer.next();
-            if (lexer.current().is('='))
+            const auto name = p->value;
+            next();
+            if (current().is('='))
             {
-                lexer.next();
+                next();
                 auto value = parse_expr();
-                vars.emplace_back(std::move(name), std::move(value));
+                vars.emplace_back(name, std::move(value));
             }
         }
 
-        if (lexer.current().is<In>())
+        if (current().is<In>())
         {
-            lexer.next();
+            next();
             auto body = parse_expr();
-            return std::make_unique<ast::LetExpr>(std::move(vars),
-                                                  std::move(body));
+            return arena->make<ast::LetExpr>(std::move(vars), std::move(body));
         }
-    }
-    else if (lexer.current().is<Invalid>())
-    {
-        return nullptr;
+        error("expected in");
     }
     return nullptr;
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_unary_expr()
+ast::Ptr<ast::Expr> Parser::parse_expr()
 {
-    if (auto expr = parse_primary_expr())
-        return expr;
+    // The frames of this call are above base, those below belong to the
+    // calls in progress that it is nested in
+    const auto base = frames.size();
+    const auto push = [&](Frame && frame)
+    {
+        frames.push_back(std::move(frame));
+        if (depth + frames.size() > limit)
+            error("expression nested too deeply");
+    };
+    const auto pop = [&]
+    {
+        auto frame = std::move(frames.back());
+        frames.pop_back();
+        return frame;
+    };
 
-    if (const auto p = std::get_if<unsigned char>(&lexer.current()))
+    if (++depth + frames.size() > limit)
+        error("expression nested too deeply");
+
+    // Minimum precedence of the operators that continue the current level
+    std::int64_t previous = 0;
+    ast::Ptr<ast::Expr> expr;
+    while (true)
     {
-        if (std::ispunct(*p))
+        // unary-expr := op unary-expr | (expr) | primary-expr
+        while (!panic)
         {
-            std::string op(1, *p);
-            lexer.next();
-            auto expr = parse_unary_expr();
-            return std::make_unique<ast::UnaryExpr>(std::move(op),
-                                                    std::move(expr));
+            if (current().is('('))
+            {
+                next();
+                push({.kind = Frame::Paren, .previous = previous});
+                previous = 0;
+            }
+            else if (expr = parse_primary_expr(); expr || panic)
+            {
+                break;
+            }
+            else if (const auto p = std::get_if<unsigned char>(&current());
+                     p && scan::is_punct(*p))
+            {
+                push({.kind = Frame::Unary, .op = Symbol(*p)});
+                next();
+            }
+            else
+            {
+                error("expected an expression");
+            }
         }
-    }
 
-    return nullptr;
+        // Every operand closes the prefix operators before it, the operand
+        // of a parenthesized expression may close the parenthesis too
+        for (bool closed = true; closed;)
+        {
+            closed = false;
+
+            while (frames.size() > base && frames.back().kind == Frame::Unary)
+                expr = make_unary(pop().op, std::move(expr));
+
+            if (frames.size() > base && frames.back().kind == Frame::Binary)
+            {
+                if (precedence.get(parse_bin_op()) > frames.back().level)
+                {
+                    previous = frames.back().level + 1;
+                }
+                else
+                {
+                    auto frame = pop();
+                    expr = make_binary(
+                        frame.op, std::move(frame.lhs), std::move(expr));
+                    previous = frame.previous;
+                }
+            }
+
+            while (true)
+            {
+                const auto op = parse_bin_op();
+                const auto level = precedence.get(op);
+                if (!panic && level >= previous)
+                {
+                    next();
+                    Frame frame{.kind = Frame::Binary,
+                                .previous = previous,
+                                .level = *level,
+                                .op = *op,
+                                .lhs = std::move(expr)};
+
+                    // Most operands are primary expressions, which need no
+                    // frame unless the operator after them binds tighter
+                    if (!current().is('('))
+                    {
+                        if (auto rhs = parse_primary_expr(); rhs || panic)
+                        {
+                            if (precedence.get(parse_bin_op()) > *level)
+                            {
+                                previous = *level + 1;
+                                push(std::move(frame));
+                                expr = std::move(rhs);
+                            }
+                            else
+                            {
+                                expr = make_binary(
+                                    *op, std::move(frame.lhs), std::move(rhs));
+                            }
+                            continue;
+                        }
+                    }
+
+                    push(std::move(frame));
+                    break;
+                }
+
+                // The operator ends the current level
+                if (frames.size() == base)
+                {
+                    --depth;
+                    return expr;
+                }
+
+                auto frame = pop();
+                previous = frame.previous;
+                if (frame.kind == Frame::Binary)
+                {
+                    expr = make_binary(
+                        frame.op, std::move(frame.lhs), std::move(expr));
+                    continue;
+                }
+
+                if (current().is(')'))
+                {
+                    next();
+                }
+                else
+                {
+                    error("expected ')'");
+                    expr = nullptr;
+                }
+                closed = true;
+                break;
+            }
+        }
+    }
 }
 
-std::unique_ptr<ast::Expr> Parser::parse_expr()
+ast::Ptr<ast::Node> Parser::parse_def()
 {
-    if (auto lhs = parse_unary_expr())
+    auto math = std::optional(ast::FastMath::none);
+    if (current().is('['))
+        math = parse_attributes();
+    if (!math)
+        return nullptr;
+
+    if (auto signature = parse_proto_type())
     {
-        return parse_bin_expr_rhs(0, std::move(lhs));
+        return arena->make<ast::Function>(
+            std::move(signature), parse_expr(), *math);
     }
 
     return nullptr;
 }
 
-std::unique_ptr<ast::Node> Parser::parse_def()
+std::optional<ast::FastMath> Parser::parse_attributes()
 {
-    if (auto signature = parse_proto_type())
+    Attributes attributes;
+    next();
+    while (true)
     {
-        return std::make_unique<ast::Function>(std::move(signature),
-                                               parse_expr());
+        const auto step = attributes.feed(current());
+        if (step == Attributes::failed)
+        {
+            error("expected a fast-math flag or ']'");
+            return std::nullopt;
+        }
+        next();
+        if (step == Attributes::done)
+            return attributes.math;
     }
-
-    return nullptr;
 }
 
-std::unique_ptr<ast::ProtoType> Parser::parse_proto_type()
+ast::Ptr<ast::ProtoType> Parser::parse_proto_type()
 {
-    std::string name;
-    std::vector<std::string> params;
+    Symbol name;
+    std::pmr::vector<Symbol> params(arena->resource());
 
-    if (const auto p = std::get_if<Identifier>(&lexer.current()))
+    if (const auto p = std::get_if<Identifier>(&current()))
     {
-        name = std::move(p->value);
-        lexer.next();
+        name = p->value;
+        next();
     }
-    else if (const auto p = std::get_if<Operator>(&lexer.current()))
+    else if (const auto p = std::get_if<Operator>(&current()))
     {
-        name = std::move(p->value);
-        lexer.next();
-        if (const auto p = std::get_if<double>(&lexer.current()))
+        name = p->value;
+        next();
+        if (const auto p = std::get_if<double>(&current()))
         {
             precedence.push(name, std::move(*p));
-            lexer.next();
+            next();
         }
     }
 
-    if (lexer.current().is('('))
+    if (current().is('('))
     {
-        lexer.next();
+        next();
         while (true)
         {
-            if (lexer.current().is(')'))
+            if (current().is(')'))
+            {
+                next();
+                return arena->make<ast::ProtoType>(name, std::move(params));
+            }
+            else if (const auto p = std::get_if<Identifier>(&current()))
             {
-                lexer.next();
-                return std::make_unique<ast::ProtoType>(std::move(name),
-                                                        std::move(params));
+                params.emplace_back(p->value);
+                next();
+                if (current().is(','))
+                    next();
             }
-            else if (const auto p = std::get_if<Identifier>(&lexer.current()))
+            else
             {
-                params.push_back(std::move(p->value));
-                lexer.next();
-                if (lexer.current().is(','))
-                    lexer.next();
+                error("expected a parameter or ')'");
+                return nullptr;
             }
         }
     }
 
+    error("expected '('");
     return nullptr;
 }
 
-std::unique_ptr<ast::Extern> Parser::parse_extern()
+ast::Ptr<ast::Extern> Parser::parse_extern()
 {
     if (auto p = parse_proto_type())
-        return std::make_unique<ast::Extern>(std::move(p));
+        return arena->make<ast::Extern>(std::move(p));
     return nullptr;
 }
 
-const std::vector<std::unique_ptr<ast::Node>> & Parser::parse()
+const std::vector<ast::Ptr<ast::Node>> & Parser::parse()
 {
-    lexer.next();
+    next();
 
-    while (true)
+    while (!current().is<Empty>())
     {
-        if (lexer.current().is<Empty>())
+        ast::Ptr<ast::Node> item;
+        if (current().is<Def>())
         {
-            break;
+            next();
+            item = parse_def();
         }
-        else if (auto p = std::get_if<Invalid>(&lexer.current()))
+        else if (current().is<Extern>())
         {
-            root.clear();
-            root.emplace_back(
-                std::make_unique<ast::Error>(std::move(p->value)));
-            break;
+            next();
+            item = parse_extern();
         }
-        else if (lexer.current().is<Def>())
+        else
         {
-            lexer.next();
-            root.emplace_back(parse_def());
+            item = parse_expr();
         }
-        else if (lexer.current().is<Extern>())
+
+        if (!item && !panic)
+            error("expected an item");
+
+        // Items never contain a def or an extern below the top level, so the
+        // rest of a broken item is skipped up to the next one. Something was
+        // consumed unless the error is at such a token, which is consumed by
+        // the next iteration.
+        if (panic)
         {
-            lexer.next();
-            root.emplace_back(parse_extern());
+            item = arena->make<ast::Error>(arena->copy(errors.back().message));
+            while (!current().is<Def>() && !current().is<Extern>()
+                   && !current().is<Empty>())
+                next();
+            panic = false;
         }
-        else
+        root.emplace_back(std::move(item));
+    }
+
+    return root;
+}
+
+const std::vector<ast::Ptr<ast::Node>> &
+Parser::parse_parallel(unsigned threads, std::size_t grain)
+{
+    assert(tokens && index == 0);
+
+    // Items end right before the next def or extern, the parser never
+    // consumes those below the top level. The tokens are split at such
+    // boundaries into tasks of at least grain tokens, each of which starts
+    // from the precedences in effect at its beginning: operators take effect
+    // as soon as the prototype that declares them is parsed.
+    struct Task
+    {
+        std::size_t begin;
+        std::size_t end;
+        Precedence::Snapshot precedence;
+        std::vector<ast::Ptr<ast::Node>> root;
+        std::vector<Diagnostic> errors;
+    };
+    std::vector<Task> tasks;
+
+    const auto & kinds = tokens->kinds;
+    std::size_t begin = 0;
+    auto start = precedence.snapshot();
+    for (std::size_t i = 0; i < end; ++i)
+    {
+        if (kinds[i] != TokenStream::kind<Def>()
+            && kinds[i] != TokenStream::kind<Extern>())
+            continue;
+
+        if (i - begin >= grain)
+        {
+            tasks.push_back({begin, i, std::move(start)});
+            begin = i;
+            start = precedence.snapshot();
+        }
+
+        // Only definitions have attributes
+        const auto j = kinds[i] == TokenStream::kind<Def>()
+                           ? prototype(*tokens, i, end)
+                           : i + 1;
+        if (j + 1 < end && kinds[j] == TokenStream::kind<Operator>()
+            && kinds[j + 1] == TokenStream::kind<double>())
         {
-            root.emplace_back(parse_expr());
+            precedence.push(tokens->symbols[j],
+                            static_cast<std::int64_t>(tokens->values[j + 1]));
         }
     }
+    tasks.push_back({begin, end, std::move(start)});
 
+    // Idle threads claim the next task in source order, a shared cursor
+    // balances the load well enough since tasks are many and similar
+    std::atomic<std::size_t> cursor = 0;
+    const auto work = [&](ast::Arena * arena, ast::Sharing * table)
+    {
+        for (std::size_t i; (i = cursor++) < tasks.size();)
+        {
+            auto & task = tasks[i];
+            Parser parser(nullptr,
+                          tokens,
+                          task.begin,
+                          task.end,
+                          task.precedence,
+                          arena,
+                          limit);
+            parser.table = table;
+            parser.parse();
+            task.root = std::move(parser.root);
+            task.errors = std::move(parser.errors);
+        }
+    };
+
+    threads = std::clamp<std::size_t>(threads, 1, tasks.size());
+    {
+        std::vector<std::jthread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            const auto arena =
+                arenas.emplace_back(std::make_unique<ast::Arena>()).get();
+            if (table)
+                tables.push_back(std::make_unique<ast::Sharing>(*arena));
+            pool.emplace_back(
+                work, arena, table ? tables.back().get() : nullptr);
+        }
+        work(arena, table);
+    }
+
+    std::size_t size = 0;
+    for (const auto & task : tasks)
+        size += task.root.size();
+    root.reserve(size);
+    for (auto & task : tasks)
+    {
+        std::move(task.root.begin(), task.root.end(), std::back_inserter(root));
+        std::move(
+            task.errors.begin(), task.errors.end(), std::back_inserter(errors));
+    }
+
+    index = end;
     return root;
 }
-
-}  // namespace mk
\ No newline at end of file
+}  // namespace mk
@@ -2,17 +2,22 @@
 #define __PARSER_H__
 
 #include "ast.h"
+#include "precedence.h"
+#include "sharing.h"
+#include "token.h"
 
 #include <memory>
 #include <optional>
-#include <shared_mutex>
-#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 namespace mk
 {
 
 class Lexer;
+struct TokenStream;
 
 namespace ast
 {
@@ -21,57 +26,166 @@ class Expr;
 class Extern;
 }  // namespace ast
 
+// A syntax error found at offset in the source
+struct Diagnostic
+{
+    std::size_t offset;
+    std::string message;
+
+    bool operator==(const Diagnostic &) const = default;
+};
+
+// Items moved out of a Parser together with the arenas that own their nodes,
+// so that they outlive the parser
+struct Parsed
+{
+    std::vector<std::unique_ptr<ast::Arena>> arenas;
+    std::vector<ast::Ptr<ast::Node>> root;
+};
+
+// Recovers from syntax errors in panic mode: the first error of a top level
+// item is reported, the item is replaced by an ast::Error and parsing resumes
+// at the next def or extern. Every item is kept, valid or not.
 class Parser
 {
 public:
-    Parser(Lexer & lexer);
+    // Expressions nested deeper than the depth limit of a parser are errors.
+    // Operators and parentheses are parsed without recursion, the limit
+    // bounds the memory of the parser and the recursion of the passes that
+    // walk the AST.
+    static constexpr std::size_t default_depth = 1 << 12;
+
+    // Pulls tokens from lexer one at a time while parsing
+    Parser(Lexer & lexer, std::size_t limit = default_depth);
+    // Reads the tokens of an input lexed upfront by Lexer::tokenize
+    Parser(const TokenStream & tokens, std::size_t limit = default_depth);
+
+    const std::vector<ast::Ptr<ast::Node>> & parse();
+
+    // Parses the top level items of a TokenStream on up to threads threads,
+    // in tasks of at least grain tokens. The result is exactly the one of
+    // parse().
+    const std::vector<ast::Ptr<ast::Node>> &
+    parse_parallel(unsigned threads = std::thread::hardware_concurrency(),
+                   std::size_t grain = 1 << 14);
+
+    // Errors of the items parsed so far, sorted by offset
+    const std::vector<Diagnostic> & diagnostics() const;
 
-    const std::vector<std::unique_ptr<ast::Node>> & parse();
+    // Hands the items parsed so far over along with their arenas, the parser
+    // can only be destroyed afterwards
+    Parsed release() &&;
+
+    // Makes the identical closed expressions parsed from now on a single
+    // node, see ast::Sharing. Expressions are only shared with others parsed
+    // by the same thread.
+    void share();
+    // Closed expressions parsed while sharing and what sharing saved
+    ast::Sharing::Report sharing() const;
 
 private:
+    friend class Document;
+
+    // Precedences of the builtin operators, shared by every parser until its
+    // first push
+    static Precedence::Snapshot builtins();
+
+    // Parses the tokens [begin, end) when reading from a TokenStream, into
+    // arena or an arena of its own
+    Parser(Lexer * lexer,
+           const TokenStream * tokens,
+           std::size_t begin,
+           std::size_t end,
+           const Precedence::Snapshot & precedence,
+           ast::Arena * arena,
+           std::size_t limit);
+
+    void next();
+    const Token & current() const;
+
+    // Reports message at the current token unless an error of the current
+    // item was reported already
+    void error(std::string message);
+
     // prototype:= identifier(identifier ,identifier*)
-    std::unique_ptr<ast::ProtoType> parse_proto_type();
+    ast::Ptr<ast::ProtoType> parse_proto_type();
     // extern := extern prototype
-    std::unique_ptr<ast::Extern> parse_extern();
-    // def := def prototype expr
-    std::unique_ptr<ast::Node> parse_def();
-    // expr := primary-expr | expr op expr
-    std::unique_ptr<ast::Expr> parse_expr();
+    ast::Ptr<ast::Extern> parse_extern();
+    // def := def [attributes] prototype expr
+    ast::Ptr<ast::Node> parse_def();
+    // attributes := '[' identifier ,identifier* ']'
+    // where each identifier names an ast::FastMath flag
+    std::optional<ast::FastMath> parse_attributes();
+    // expr := unary-expr | expr op expr
+    ast::Ptr<ast::Expr> parse_expr();
     // literal-expr := literal
-    std::unique_ptr<ast::Expr> parse_literal_expr(double value);
+    ast::Ptr<ast::Expr> parse_literal_expr(double value);
     // identifier-expr := identifier | call-expr
-    std::unique_ptr<ast::Expr> parse_identifier_expr(std::string && name);
-    // primary-expr := (expr) | literal-expr | identifier-expr | conditionl-expr
-    // | for-expr
-    std::unique_ptr<ast::Expr> parse_primary_expr();
+    ast::Ptr<ast::Expr> parse_identifier_expr(Symbol name);
+    // primary-expr := literal-expr | identifier-expr | conditionl-expr
+    // | for-expr | let-expr
+    ast::Ptr<ast::Expr> parse_primary_expr();
     // call-expr := identifier() | identifier(expr ,expr*)
-    std::unique_ptr<ast::Expr> parse_call_expr(std::string && name);
-    // unary-expr = op unary-expr | primary-expr
-    std::unique_ptr<ast::Expr> parse_unary_expr();
-    std::unique_ptr<ast::Expr>
-    parse_bin_expr_rhs(std::int64_t previous,
-                       std::unique_ptr<ast::Expr> && lhs);
-    std::optional<std::string> parse_bin_op();
+    ast::Ptr<ast::Expr> parse_call_expr(Symbol name);
+    std::optional<Symbol> parse_bin_op();
+
+    // Make operators through table if sharing is enabled
+    ast::Ptr<ast::Expr> make_unary(Symbol op, ast::Ptr<ast::Expr> && operand);
+    ast::Ptr<ast::Expr> make_binary(Symbol op,
+                                    ast::Ptr<ast::Expr> && lhs,
+                                    ast::Ptr<ast::Expr> && rhs);
+
 
+    // Own the nodes reachable from root, one per thread that parsed them
+    std::vector<std::unique_ptr<ast::Arena>> arenas;
+    // Where this parser allocates nodes
+    ast::Arena * arena;
+    // Shares the closed expressions made in arena, null unless sharing is
+    // enabled. One per arena that sharing was enabled for.
+    ast::Sharing * table = nullptr;
+    std::vector<std::unique_ptr<ast::Sharing>> tables;
+    std::vector<ast::Ptr<ast::Node>> root;
 
-    std::vector<std::unique_ptr<ast::Node>> root;
-    Lexer & lexer;
+    // Exactly one of them is set
+    Lexer * lexer;
+    const TokenStream * tokens;
+    std::size_t index;
+    std::size_t end;
+    Token token;
+    // Position of token in the source
+    std::size_t position = 0;
 
+    Precedence precedence;
 
-    struct Precedence
+    std::vector<Diagnostic> errors;
+    // Whether the current item has an error
+    bool panic = false;
+
+    // Operators and parentheses of parse_expr waiting for their operands, on
+    // an explicit stack rather than the call stack so that nesting only costs
+    // memory. A binary operator waits for its rhs, or for the operators
+    // binding tighter than itself that follow the rhs.
+    struct Frame
     {
-    public:
-        Precedence(std::unordered_map<std::string, std::int64_t> && init)
-            : map(std::move(init))
-        {}
-        void push(const std::string & op, std::int64_t value);
-        std::optional<std::int64_t>
-        get(const std::optional<std::string> & op) const;
-
-    private:
-        std::unordered_map<std::string, std::int64_t> map;
-        mutable std::shared_mutex mutex;
-    } precedence;
+        enum
+        {
+            Unary,
+            Binary,
+            Paren,
+        } kind;
+        // Binary frames: the minimum precedence of the enclosing level and
+        // the precedence of op
+        std::int64_t previous = 0;
+        std::int64_t level = 0;
+        Symbol op;
+        ast::Ptr<ast::Expr> lhs;
+    };
+    std::vector<Frame> frames;
+
+    // Calls of parse_expr in progress, the nesting of the expression being
+    // parsed is depth + frames.size()
+    std::size_t depth = 0;
+    std::size_t limit;
 };
 }  // namespace mk
 
@@ -0,0 +1,46 @@
+#include "precedence.h"
+
+#include <atomic>
+
+namespace mk
+{
+Precedence::Precedence(
+    std::initializer_list<std::pair<Symbol, std::int64_t>> init)
+    : table(std::make_shared<Table>())
+{
+    table->bytes.fill(Table::absent);
+    for (const auto & [op, value] : init)
+        push(op, value);
+}
+
+Precedence::Precedence(const Snapshot & snapshot)
+    // Copied lazily by the first push
+    : table(std::const_pointer_cast<Table>(snapshot))
+{}
+
+void Precedence::push(Symbol op, std::int64_t value)
+{
+    if (get(op))
+        return;
+
+    // Snapshots handed out are never modified, only unshared tables are. The
+    // fence orders the writes below after the reads of the last thread that
+    // released the table.
+    if (table.use_count() > 1)
+        table = std::make_shared<Table>(*table);
+    else
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+    const auto id = op.id();
+    if (id < 256)
+    {
+        table->bytes[id] = value;
+    }
+    else
+    {
+        if (table->symbols.size() <= id - 256)
+            table->symbols.resize(id - 255, Table::absent);
+        table->symbols[id - 256] = value;
+    }
+}
+}  // namespace mk
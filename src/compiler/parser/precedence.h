@@ -0,0 +1,72 @@
+#ifndef __PRECEDENCE_H__
+#define __PRECEDENCE_H__
+
+#include "compiler/lexer/symbol.h"
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace mk
+{
+// Precedence of the binary operators known to a parser. Single byte operators
+// are looked up in a flat array and the others in a table indexed by symbol,
+// so lookups neither hash nor allocate.
+//
+// Published tables are immutable: push() modifies a private copy whenever the
+// current table is shared, and snapshot() hands out the current table. Other
+// threads can keep parsing with a snapshot while this registry keeps changing,
+// and no read needs a lock or an atomic operation.
+class Precedence
+{
+public:
+    struct Table
+    {
+        static constexpr std::int64_t absent =
+            std::numeric_limits<std::int64_t>::min();
+
+        std::array<std::int64_t, 256> bytes;
+        // Indexed by Symbol::id() - 256
+        std::vector<std::int64_t> symbols;
+
+        bool operator==(const Table &) const = default;
+    };
+
+    using Snapshot = std::shared_ptr<const Table>;
+
+    Precedence(std::initializer_list<std::pair<Symbol, std::int64_t>> init);
+    Precedence(const Snapshot & snapshot);
+
+    // Registers the precedence of op unless it already has one
+    void push(Symbol op, std::int64_t value);
+
+    std::optional<std::int64_t> get(const std::optional<Symbol> & op) const
+    {
+        if (!op)
+            return std::nullopt;
+
+        const auto id = op->id();
+        std::int64_t value = Table::absent;
+        if (id < 256)
+            value = table->bytes[id];
+        else if (id - 256 < table->symbols.size())
+            value = table->symbols[id - 256];
+
+        if (value == Table::absent)
+            return std::nullopt;
+        return value;
+    }
+
+    Snapshot snapshot() const { return table; }
+
+private:
+    std::shared_ptr<Table> table;
+};
+}  // namespace mk
+
+#endif
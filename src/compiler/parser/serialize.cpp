@@ -0,0 +1,454 @@
+#include "serialize.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace mk
+{
+namespace ast
+{
+namespace flat
+{
+namespace
+{
+constexpr std::string_view magic = "KAST";
+constexpr std::size_t sections = 7;
+constexpr std::size_t header = 4 + 4 + 8 + 4 * sections;
+
+// Converts between the order of the host and little endian, both ways
+template <typename T>
+T little(T value)
+{
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        return value;
+    }
+    else
+    {
+        T swapped = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i, value >>= 8)
+            swapped = (swapped << 8) | (value & 0xff);
+        return swapped;
+    }
+}
+
+// Writes into a buffer sized upfront
+class Writer
+{
+public:
+    Writer(std::string & out) : out(out) {}
+
+    template <typename T>
+    void put(T value)
+    {
+        value = little(value);
+        std::memcpy(out.data() + at, &value, sizeof(T));
+        at += sizeof(T);
+    }
+
+    void put(double value) { put(std::bit_cast<std::uint64_t>(value)); }
+
+    void put(std::string_view text)
+    {
+        text.copy(out.data() + at, text.size());
+        at += text.size();
+    }
+
+private:
+    std::string & out;
+    std::size_t at = 0;
+};
+
+// Reads from data, has() must be checked before reading
+class Reader
+{
+public:
+    Reader(std::string_view data) : data(data) {}
+
+    bool has(std::uint64_t size) const { return size <= data.size() - at; }
+    bool done() const { return at == data.size(); }
+
+    template <typename T>
+    T get()
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return std::bit_cast<T>(get<std::uint64_t>());
+        }
+        else
+        {
+            T value;
+            std::memcpy(&value, data.data() + at, sizeof(T));
+            at += sizeof(T);
+            return little(value);
+        }
+    }
+
+    // Reads count values at once, they are already in the right order on
+    // little endian hosts
+    template <typename T>
+    void get(std::vector<T> & values, std::size_t count)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            values.resize(count);
+            std::memcpy(values.data(), data.data() + at, count * sizeof(T));
+            at += count * sizeof(T);
+        }
+        else
+        {
+            values.reserve(count);
+            for (std::size_t i = 0; i < count; ++i)
+                values.push_back(get<T>());
+        }
+    }
+
+    std::string_view text(std::size_t size)
+    {
+        const auto text = data.substr(at, size);
+        at += size;
+        return text;
+    }
+
+private:
+    std::string_view data;
+    std::size_t at = 0;
+};
+
+// Texts stored once each, in the order they were first added
+struct Strings
+{
+    std::uint32_t add(std::string_view text)
+    {
+        const auto [it, added] = indices.try_emplace(text, texts.size());
+        if (added)
+        {
+            texts.push_back(text);
+            size += text.size();
+        }
+        return it->second;
+    }
+
+    std::vector<std::string_view> texts;
+    std::unordered_map<std::string_view, std::uint32_t> indices;
+    std::size_t size = 0;
+};
+
+void put(Writer & writer, const Strings & strings)
+{
+    for (const auto text : strings.texts)
+        writer.put(static_cast<std::uint32_t>(text.size()));
+    for (const auto text : strings.texts)
+        writer.put(text);
+}
+
+bool get(Reader & reader,
+         std::uint32_t count,
+         std::vector<std::string_view> & texts)
+{
+    if (!reader.has(std::uint64_t{4} * count))
+        return false;
+
+    std::vector<std::uint32_t> sizes(count);
+    std::uint64_t size = 0;
+    for (auto & s : sizes)
+        size += s = reader.get<std::uint32_t>();
+    if (!reader.has(size))
+        return false;
+
+    texts.reserve(count);
+    for (const auto s : sizes)
+        texts.push_back(reader.text(s));
+    return true;
+}
+
+bool is_expr(Kind kind)
+{
+    return kind <= Kind::LetExpr;
+}
+
+// Whether child can be the index-th of the count children of a parent of the
+// given kind, none stands for a child the parser could not produce
+bool fits(Kind parent,
+          std::size_t index,
+          std::size_t count,
+          std::uint32_t child,
+          Kind kind)
+{
+    switch (parent)
+    {
+    case Kind::LetExpr:
+        if (index + 1 < count)
+            return child != none && kind == Kind::Binding;
+        return child == none || is_expr(kind);
+    case Kind::ProtoType:
+        return child != none && kind == Kind::Param;
+    case Kind::Function:
+        if (index == 0)
+            return child == none || kind == Kind::ProtoType;
+        return child == none || is_expr(kind);
+    case Kind::Extern:
+        return child == none || kind == Kind::ProtoType;
+    default:
+        return child == none || is_expr(kind);
+    }
+}
+
+// Whether the nodes form one tree per root and every node has the children
+// its kind calls for, which unflatten() relies on
+bool valid(const Tree & tree)
+{
+    std::vector<char> owned(tree.nodes.size());
+    for (std::uint32_t i = 0; i < tree.nodes.size(); ++i)
+    {
+        const auto & node = tree.nodes[i];
+        if (node.kind == Kind::Literal || node.kind == Kind::Error)
+        {
+            const auto size = node.kind == Kind::Literal ? tree.literals.size()
+                                                         : tree.errors.size();
+            if (node.count || node.first >= size)
+                return false;
+            continue;
+        }
+
+        if (std::uint64_t{node.first} + node.count > tree.children.size())
+            return false;
+
+        std::size_t count = node.count;
+        switch (node.kind)
+        {
+        case Kind::Variable:
+        case Kind::Param:
+            count = 0;
+            break;
+        case Kind::UnaryExpr:
+        case Kind::Binding:
+        case Kind::Extern:
+            count = 1;
+            break;
+        case Kind::BinExpr:
+        case Kind::Function:
+            count = 2;
+            break;
+        case Kind::ConditionalExpr:
+            count = 3;
+            break;
+        case Kind::ForExpr:
+            count = 4;
+            break;
+        case Kind::LetExpr:
+            count = std::max<std::size_t>(count, 1);
+            break;
+        default:
+            break;
+        }
+        if (node.count != count)
+            return false;
+
+        const auto children = tree.children_of(i);
+        for (std::size_t k = 0; k < children.size(); ++k)
+        {
+            const auto child = children[k];
+            if (child != none && (child >= i || owned[child]))
+                return false;
+            const auto kind = child == none ? Kind::Error
+                                            : tree.nodes[child].kind;
+            if (!fits(node.kind, k, count, child, kind))
+                return false;
+            if (child != none)
+                owned[child] = true;
+        }
+    }
+
+    // Every node belongs to the item of the first root that follows it
+    for (std::size_t k = 0; k < tree.roots.size(); ++k)
+    {
+        const auto root = tree.roots[k];
+        if (root >= tree.nodes.size() || owned[root]
+            || (k && root <= tree.roots[k - 1]))
+            return false;
+        const auto kind = tree.nodes[root].kind;
+        if (kind == Kind::Binding || kind == Kind::Param)
+            return false;
+        owned[root] = true;
+    }
+    return std::ranges::find(owned, 0) == owned.cend();
+}
+}  // namespace
+
+std::uint64_t fingerprint(std::string_view source)
+{
+    // A word at a time
+    std::uint64_t hash = source.size();
+    std::size_t i = 0;
+    for (; i + 8 <= source.size(); i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, source.data() + i, 8);
+        hash = combine(hash, little(word));
+    }
+    if (i < source.size())
+    {
+        std::uint64_t word = 0;
+        std::memcpy(&word, source.data() + i, source.size() - i);
+        hash = combine(hash, little(word));
+    }
+    return avalanche(hash);
+}
+
+std::string serialize(const Tree & tree, std::uint64_t fingerprint)
+{
+    Strings names;
+    // Indexed by Symbol::id(), symbols are dense
+    std::vector<std::uint32_t> indices(Symbol::count(), none);
+    std::vector<std::uint32_t> nodes;
+    nodes.reserve(tree.nodes.size());
+    for (const auto & node : tree.nodes)
+    {
+        auto & index = indices[node.name.id()];
+        if (index == none)
+            index = names.add(node.name.str());
+        nodes.push_back(index);
+    }
+
+    Strings messages;
+    std::vector<std::uint32_t> errors;
+    errors.reserve(tree.errors.size());
+    for (const auto error : tree.errors)
+        errors.push_back(messages.add(error));
+
+    const std::array<std::uint32_t, sections> counts{
+        static_cast<std::uint32_t>(tree.literals.size()),
+        static_cast<std::uint32_t>(names.texts.size()),
+        static_cast<std::uint32_t>(messages.texts.size()),
+        static_cast<std::uint32_t>(tree.nodes.size()),
+        static_cast<std::uint32_t>(tree.children.size()),
+        static_cast<std::uint32_t>(tree.errors.size()),
+        static_cast<std::uint32_t>(tree.roots.size())};
+
+    std::string out(header + 8 * tree.literals.size()
+                        + 4 * names.texts.size() + names.size
+                        + 4 * messages.texts.size() + messages.size
+                        + 16 * tree.nodes.size() + 4 * tree.children.size()
+                        + 4 * tree.errors.size() + 4 * tree.roots.size(),
+                    '\0');
+    Writer writer(out);
+
+    writer.put(magic);
+    writer.put(version);
+    writer.put(fingerprint);
+    for (const auto count : counts)
+        writer.put(count);
+
+    for (const auto literal : tree.literals)
+        writer.put(literal);
+    put(writer, names);
+    put(writer, messages);
+    for (std::size_t i = 0; i < tree.nodes.size(); ++i)
+    {
+        const auto & node = tree.nodes[i];
+        writer.put(static_cast<std::uint8_t>(node.kind));
+        writer.put(node.flags);
+        writer.put(std::uint16_t{0});
+        writer.put(nodes[i]);
+        writer.put(node.first);
+        writer.put(node.count);
+    }
+    for (const auto child : tree.children)
+        writer.put(child);
+    for (const auto error : errors)
+        writer.put(error);
+    for (const auto root : tree.roots)
+        writer.put(root);
+
+    return out;
+}
+
+std::optional<Tree> deserialize(std::string_view data,
+                                std::uint64_t fingerprint)
+{
+    Reader reader(data);
+    if (!reader.has(header) || reader.text(magic.size()) != magic
+        || reader.get<std::uint32_t>() != version
+        || reader.get<std::uint64_t>() != fingerprint)
+        return std::nullopt;
+
+    std::array<std::uint32_t, sections> counts;
+    for (auto & count : counts)
+        count = reader.get<std::uint32_t>();
+    const auto [literals, names, messages, nodes, children, errors, roots] =
+        counts;
+
+    Tree tree;
+
+    if (!reader.has(std::uint64_t{8} * literals))
+        return std::nullopt;
+    reader.get(tree.literals, literals);
+
+    std::vector<std::string_view> texts;
+    if (!get(reader, names, texts))
+        return std::nullopt;
+    std::vector<Symbol> symbols(texts.cbegin(), texts.cend());
+
+    texts.clear();
+    if (!get(reader, messages, texts))
+        return std::nullopt;
+
+    if (!reader.has(std::uint64_t{16} * nodes))
+        return std::nullopt;
+    tree.nodes.reserve(nodes);
+    for (std::uint32_t i = 0; i < nodes; ++i)
+    {
+        const auto kind = reader.get<std::uint8_t>();
+        const auto flags = reader.get<std::uint8_t>();
+        const auto zero = reader.get<std::uint16_t>();
+        const auto name = reader.get<std::uint32_t>();
+        const auto first = reader.get<std::uint32_t>();
+        const auto count = reader.get<std::uint32_t>();
+        if (kind > static_cast<std::uint8_t>(Kind::Error) || zero
+            || name >= symbols.size())
+            return std::nullopt;
+        if (flags
+            && (static_cast<Kind>(kind) != Kind::Function
+                || flags > static_cast<std::uint8_t>(FastMath::fast)))
+            return std::nullopt;
+        tree.nodes.push_back({static_cast<Kind>(kind),
+                              flags,
+                              symbols[name],
+                              first,
+                              count});
+    }
+
+    if (!reader.has(std::uint64_t{4} * children))
+        return std::nullopt;
+    reader.get(tree.children, children);
+
+    if (!reader.has(std::uint64_t{4} * errors))
+        return std::nullopt;
+    tree.errors.reserve(errors);
+    for (std::uint32_t i = 0; i < errors; ++i)
+    {
+        const auto message = reader.get<std::uint32_t>();
+        if (message >= texts.size())
+            return std::nullopt;
+        tree.errors.push_back(texts[message]);
+    }
+
+    if (!reader.has(std::uint64_t{4} * roots))
+        return std::nullopt;
+    reader.get(tree.roots, roots);
+
+    if (!reader.done() || !valid(tree))
+        return std::nullopt;
+    return tree;
+}
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
@@ -0,0 +1,51 @@
+#ifndef __SERIALIZE_H__
+#define __SERIALIZE_H__
+
+#include "flat.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mk
+{
+namespace ast
+{
+namespace flat
+{
+// Binary form of a Tree, meant to be cached next to the source it was parsed
+// from. Every integer is little endian and of fixed width:
+//
+//   header    magic "KAST", u32 version, u64 fingerprint of the source,
+//             u32 count of each section below in order
+//   literals  f64 per literal
+//   names     u32 length per name, then the bytes of all the names
+//   messages  u32 length per error message, then their bytes
+//   nodes     u8 kind, u8 flags, u16 zero, u32 name index, u32 first,
+//             u32 count per node
+//   children  u32 per child
+//   errors    u32 message index per error
+//   roots     u32 per top level item
+//
+// Names and messages are stored once as text since symbol ids differ from
+// one process to the next. Everything else refers to other entries by index,
+// so a reader only interns the names and copies the sections.
+constexpr std::uint32_t version = 2;
+
+// Hash of a source text that ties a serialized tree to it, the same on every
+// host
+std::uint64_t fingerprint(std::string_view source);
+
+std::string serialize(const Tree & tree, std::uint64_t fingerprint);
+
+// Reads back the tree of serialize(), or nothing if data is malformed, of
+// another version or of a source with another fingerprint. The error messages
+// of the tree point into data.
+std::optional<Tree> deserialize(std::string_view data,
+                                std::uint64_t fingerprint);
+}  // namespace flat
+}  // namespace ast
+}  // namespace mk
+
+#endif
@@ -0,0 +1,144 @@
+#include "sharing.h"
+
+#include "hash.h"
+
+#include <bit>
+#include <utility>
+
+namespace mk
+{
+namespace ast
+{
+namespace
+{
+std::uint64_t address(const Ptr<Expr> & expr)
+{
+    return reinterpret_cast<std::uintptr_t>(expr.get());
+}
+}  // namespace
+
+Sharing::Report & Sharing::Report::operator+=(const Report & other)
+{
+    closed += other.closed;
+    shared += other.shared;
+    bytes += other.bytes;
+    return *this;
+}
+
+template <typename T, typename Equal, typename Make>
+Ptr<Expr>
+Sharing::find(Kind kind, std::uint64_t hash, Equal && equal, Make && make)
+{
+    ++stats.closed;
+    const auto [first, last] = table.equal_range(hash);
+    for (auto it = first; it != last; ++it)
+    {
+        // Nodes of another type may collide
+        if (it->second->kind == kind && equal(static_cast<T &>(*it->second)))
+        {
+            ++stats.shared;
+            stats.bytes += sizeof(T);
+            return Ptr<Expr>(it->second);
+        }
+    }
+
+    Ptr<Expr> expr = make();
+    expr->shared = true;
+    table.emplace(hash, expr.get());
+    return expr;
+}
+
+Ptr<Expr> Sharing::literal(double value)
+{
+    const auto bits = std::bit_cast<std::uint64_t>(value);
+    return find<Literal>(
+        Kind::Literal,
+        combine(static_cast<std::uint64_t>(Kind::Literal), bits),
+        [&](const Literal & literal)
+        { return std::bit_cast<std::uint64_t>(literal.value) == bits; },
+        [&] { return arena.make<Literal>(value); });
+}
+
+Ptr<Expr> Sharing::unary(Symbol op, Ptr<Expr> && operand)
+{
+    if (!is_closed(operand))
+        return arena.make<UnaryExpr>(op, std::move(operand));
+
+    auto hash = combine(static_cast<std::uint64_t>(Kind::UnaryExpr), op.id());
+    hash = combine(hash, address(operand));
+    return find<UnaryExpr>(
+        Kind::UnaryExpr,
+        hash,
+        [&](const UnaryExpr & unary)
+        { return unary.op == op && unary.operand == operand; },
+        [&] { return arena.make<UnaryExpr>(op, std::move(operand)); });
+}
+
+Ptr<Expr> Sharing::binary(Symbol op, Ptr<Expr> && lhs, Ptr<Expr> && rhs)
+{
+    if (!is_closed(lhs) || !is_closed(rhs))
+        return arena.make<BinExpr>(op, std::move(lhs), std::move(rhs));
+
+    auto hash = combine(static_cast<std::uint64_t>(Kind::BinExpr), op.id());
+    hash = combine(combine(hash, address(lhs)), address(rhs));
+    return find<BinExpr>(
+        Kind::BinExpr,
+        hash,
+        [&](const BinExpr & bin)
+        { return bin.op == op && bin.lhs == lhs && bin.rhs == rhs; },
+        [&]
+        { return arena.make<BinExpr>(op, std::move(lhs), std::move(rhs)); });
+}
+
+Ptr<Expr> Sharing::call(Symbol name, std::pmr::vector<Ptr<Expr>> && args)
+{
+    auto hash = combine(static_cast<std::uint64_t>(Kind::CallExpr), name.id());
+    for (const auto & arg : args)
+    {
+        if (!is_closed(arg))
+            return arena.make<CallExpr>(name, std::move(args));
+        hash = combine(hash, address(arg));
+    }
+
+    return find<CallExpr>(
+        Kind::CallExpr,
+        hash,
+        [&](const CallExpr & call)
+        { return call.name == name && call.args == args; },
+        [&] { return arena.make<CallExpr>(name, std::move(args)); });
+}
+
+Ptr<Expr> Sharing::conditional(Ptr<Expr> && condition,
+                               Ptr<Expr> && first,
+                               Ptr<Expr> && second)
+{
+    if (!is_closed(condition) || !is_closed(first) || !is_closed(second))
+        return arena.make<ConditionalExpr>(
+            std::move(condition), std::move(first), std::move(second));
+
+    auto hash = static_cast<std::uint64_t>(Kind::ConditionalExpr);
+    hash = combine(combine(hash, address(condition)), address(first));
+    hash = combine(hash, address(second));
+    return find<ConditionalExpr>(
+        Kind::ConditionalExpr,
+        hash,
+        [&](const ConditionalExpr & conditional)
+        {
+            return conditional.condition == condition
+                   && conditional.first == first
+                   && conditional.second == second;
+        },
+        [&]
+        {
+            return arena.make<ConditionalExpr>(
+                std::move(condition), std::move(first), std::move(second));
+        });
+}
+
+std::ostream & operator<<(std::ostream & os, const Sharing::Report & report)
+{
+    return os << "shared " << report.shared << " of " << report.closed
+              << " closed expressions, " << report.bytes << " bytes saved";
+}
+}  // namespace ast
+}  // namespace mk
@@ -0,0 +1,81 @@
+#ifndef __SHARING_H__
+#define __SHARING_H__
+
+#include "ast.h"
+
+#include "compiler/lexer/symbol.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <ostream>
+#include <unordered_map>
+
+namespace mk
+{
+namespace ast
+{
+// Hash-consing of closed expressions: literals, and operators, calls and
+// conditionals whose operands are all closed. An expression made through the
+// table that is identical to one made before is not made again, its parent
+// points to the node made first. Operands are compared by address, they are
+// shared already, so a lookup never walks a subtree.
+//
+// Expressions that name a variable are never shared: the same name is bound
+// in different scopes, and passes annotate variables per occurrence. Passes
+// that rewrite shared nodes in place rewrite every occurrence at once, which
+// is only right for rewrites that do not depend on the context.
+class Sharing
+{
+public:
+    struct Report
+    {
+        // Closed expressions made through the table, and how many of them
+        // reused a node
+        std::size_t closed = 0;
+        std::size_t shared = 0;
+        // Node bytes that were not allocated
+        std::size_t bytes = 0;
+
+        Report & operator+=(const Report & other);
+    };
+
+    // Makes the nodes in arena
+    Sharing(Arena & arena) : arena(arena) {}
+
+    Ptr<Expr> literal(double value);
+    Ptr<Expr> unary(Symbol op, Ptr<Expr> && operand);
+    Ptr<Expr> binary(Symbol op, Ptr<Expr> && lhs, Ptr<Expr> && rhs);
+    Ptr<Expr> call(Symbol name, std::pmr::vector<Ptr<Expr>> && args);
+    Ptr<Expr> conditional(Ptr<Expr> && condition,
+                          Ptr<Expr> && first,
+                          Ptr<Expr> && second);
+
+    const Report & report() const { return stats; }
+
+private:
+    // Closed expressions are the ones made through a table
+    static bool is_closed(const Ptr<Expr> & expr)
+    {
+        return expr && expr->shared;
+    }
+
+    // The node of type T made before that equal() accepts, or a new one
+    // from make()
+    template <typename T, typename Equal, typename Make>
+    Ptr<Expr>
+    find(Kind kind, std::uint64_t hash, Equal && equal, Make && make);
+
+    Arena & arena;
+    // Closed expressions by a hash of their kind, fields and operand
+    // addresses
+    std::unordered_multimap<std::uint64_t, Expr *> table;
+    Report stats;
+};
+
+// Prints the report in one line
+std::ostream & operator<<(std::ostream & os, const Sharing::Report & report);
+}  // namespace ast
+}  // namespace mk
+
+#endif
@@ -0,0 +1,320 @@
+#include "fold.h"
+#include "walk.h"
+
+#include <optional>
+#include <utility>
+
+namespace mk
+{
+namespace passes
+{
+namespace
+{
+// Binds names to the literals that replace them for the lifetime of the
+// scope, the bindings they shadow are restored when it ends
+class Scope
+{
+public:
+    Scope(std::vector<ast::Literal *> & literals) : literals(literals) {}
+
+    ~Scope()
+    {
+        for (auto it = shadowed.rbegin(); it != shadowed.rend(); ++it)
+            literals[it->first.id()] = it->second;
+    }
+
+    void bind(Symbol name, ast::Literal * literal)
+    {
+        shadowed.emplace_back(name,
+                              std::exchange(at(literals, name), literal));
+    }
+
+private:
+    std::vector<ast::Literal *> & literals;
+    std::vector<std::pair<Symbol, ast::Literal *>> shadowed;
+};
+
+std::size_t count(ast::Node * node)
+{
+    std::size_t count = 0;
+    walk(node, [&](ast::Node &) { ++count; });
+    return count;
+}
+
+ast::Literal * literal(const ast::Ptr<ast::Expr> & expr)
+{
+    return expr && expr->kind == ast::Kind::Literal
+               ? static_cast<ast::Literal *>(expr.get())
+               : nullptr;
+}
+
+// Value of a builtin binary operator applied to literals as the generated
+// code computes it, nothing for other operators and operands
+std::optional<double> evaluate(const ast::BinExpr & bin)
+{
+    const auto lhs = literal(bin.lhs);
+    const auto rhs = literal(bin.rhs);
+    if (!lhs || !rhs)
+        return std::nullopt;
+
+    const auto l = lhs->value;
+    const auto r = rhs->value;
+    switch (bin.op.id())
+    {
+    case '+':
+        return l + r;
+    case '-':
+        return l - r;
+    case '*':
+        return l * r;
+    case '<':
+        // fcmp ult, true when either side is NaN
+        return !(l >= r) ? 1.0 : 0.0;
+    default:
+        return std::nullopt;
+    }
+}
+
+bool is_expr(ast::Kind kind)
+{
+    return kind != ast::Kind::ProtoType && kind != ast::Kind::Function
+           && kind != ast::Kind::Extern && kind != ast::Kind::Error;
+}
+}  // namespace
+
+std::vector<ast::Ptr<ast::Node>>
+Fold::operator()(const std::vector<ast::Ptr<ast::Node>> & root)
+{
+    assigned.assign(Symbol::count(), false);
+
+    std::size_t before = 0;
+    std::vector<ast::Ptr<ast::Node>> items;
+    for (const auto & node : root)
+    {
+        if (!node)
+            continue;
+
+        std::vector<Symbol> names;
+        walk(node.get(),
+             [&](ast::Node & node)
+             {
+                 ++before;
+                 if (node.kind != ast::Kind::BinExpr)
+                     return;
+                 const auto & bin = static_cast<ast::BinExpr &>(node);
+                 if (bin.op.id() == '=' && bin.lhs
+                     && bin.lhs->kind == ast::Kind::Variable)
+                     names.push_back(
+                         static_cast<ast::Variable &>(*bin.lhs).name);
+             });
+        for (const auto name : names)
+            assigned[name.id()] = true;
+
+        if (is_expr(node->kind))
+        {
+            ast::Ptr<ast::Expr> expr(static_cast<ast::Expr *>(node.get()));
+            fold(expr);
+            if (expr->kind == ast::Kind::Literal)
+                ++counts.items;
+            else
+                items.emplace_back(std::move(expr));
+        }
+        else
+        {
+            dispatch(*node);
+            items.emplace_back(node.get());
+        }
+
+        for (const auto name : names)
+            assigned[name.id()] = false;
+    }
+
+    // Functions are referred to by calls and by operators that are not
+    // builtin, marking the builtin ones as well does no harm
+    std::size_t after = 0;
+    std::vector<bool> referenced(Symbol::count());
+    for (const auto & item : items)
+    {
+        walk(item.get(),
+             [&](ast::Node & node)
+             {
+                 ++after;
+                 if (node.kind == ast::Kind::CallExpr)
+                     referenced[static_cast<ast::CallExpr &>(node).name.id()] =
+                         true;
+                 else if (node.kind == ast::Kind::UnaryExpr)
+                     referenced[static_cast<ast::UnaryExpr &>(node).op.id()] =
+                         true;
+                 else if (node.kind == ast::Kind::BinExpr)
+                     referenced[static_cast<ast::BinExpr &>(node).op.id()] =
+                         true;
+             });
+    }
+
+    std::erase_if(items,
+                  [&](const ast::Ptr<ast::Node> & item)
+                  {
+                      if (item->kind != ast::Kind::Extern)
+                          return false;
+                      const auto & prototype =
+                          static_cast<ast::Extern &>(*item).prototype;
+                      if (!prototype || referenced[prototype->name.id()])
+                          return false;
+                      ++counts.items;
+                      after -= count(item.get());
+                      return true;
+                  });
+
+    counts.nodes += before - after;
+    return items;
+}
+
+void Fold::fold(ast::Ptr<ast::Expr> & expr)
+{
+    slot = &expr;
+    dispatch(*expr);
+}
+
+bool Fold::substitutes(Symbol name, const ast::Ptr<ast::Expr> & value) const
+{
+    return literal(value) && !assigned[name.id()];
+}
+
+void Fold::visit(ast::Variable & variable)
+{
+    if (const auto literal = lookup(literals, variable.name))
+    {
+        // The literal now has a parent per use
+        literal->shared = true;
+        *slot = ast::Ptr<ast::Expr>(literal);
+    }
+}
+
+void Fold::visit(ast::Literal &) {}
+
+void Fold::visit(ast::UnaryExpr &)
+{
+    operators(*slot);
+}
+
+void Fold::visit(ast::BinExpr &)
+{
+    operators(*slot);
+}
+
+void Fold::operators(ast::Ptr<ast::Expr> & expr)
+{
+    passes::operators(
+        expr,
+        [&](ast::Ptr<ast::Expr> & operand)
+        {
+            if (operand)
+                fold(operand);
+        },
+        [&](ast::Ptr<ast::Expr> & operation)
+        {
+            if (operation->kind != ast::Kind::BinExpr)
+                return;
+            if (const auto value =
+                    evaluate(static_cast<ast::BinExpr &>(*operation)))
+            {
+                operation = arena.make<ast::Literal>(*value);
+                ++counts.operators;
+            }
+        });
+}
+
+void Fold::visit(ast::CallExpr & call)
+{
+    for (auto & arg : call.args)
+        if (arg)
+            fold(arg);
+}
+
+void Fold::visit(ast::ConditionalExpr & conditional)
+{
+    auto & expr = *slot;
+    if (conditional.condition)
+        fold(conditional.condition);
+
+    // A conditional that misses a branch fails to generate, it is kept so
+    // that it still does
+    const auto condition = literal(conditional.condition);
+    if (condition && conditional.first && conditional.second)
+    {
+        // fcmp one, false when the condition is NaN
+        auto & taken = condition->value < 0 || condition->value > 0
+                           ? conditional.first
+                           : conditional.second;
+        fold(taken);
+        // The conditional may be shared, its branches stay in place
+        expr = ast::Ptr<ast::Expr>(taken.get());
+        ++counts.branches;
+        return;
+    }
+
+    if (conditional.first)
+        fold(conditional.first);
+    if (conditional.second)
+        fold(conditional.second);
+}
+
+void Fold::visit(ast::ForExpr & loop)
+{
+    if (loop.init)
+        fold(loop.init);
+
+    Scope scope(literals);
+    scope.bind(loop.name, nullptr);
+    for (const auto expr : {&loop.condition, &loop.step, &loop.body})
+        if (*expr)
+            fold(*expr);
+}
+
+void Fold::visit(ast::LetExpr & let)
+{
+    auto & expr = *slot;
+    {
+        // Names are bound one after the other, each value sees the names
+        // bound before it. A name whose value is missing is not bound.
+        Scope scope(literals);
+        for (auto & [name, value] : let.vars)
+        {
+            if (!value)
+                continue;
+            fold(value);
+            scope.bind(name,
+                       substitutes(name, value) ? literal(value) : nullptr);
+        }
+        if (let.body)
+            fold(let.body);
+    }
+
+    counts.bindings += std::erase_if(
+        let.vars,
+        [&](const auto & var) { return substitutes(var.first, var.second); });
+    if (let.vars.empty() && let.body)
+        expr = ast::Ptr<ast::Expr>(let.body.get());
+}
+
+void Fold::visit(ast::ProtoType &) {}
+
+void Fold::visit(ast::Function & function)
+{
+    if (function.body)
+        fold(function.body);
+}
+
+void Fold::visit(ast::Extern &) {}
+
+void Fold::visit(ast::Error &) {}
+
+std::ostream & operator<<(std::ostream & os, const Fold::Stats & stats)
+{
+    return os << "folded " << stats.operators << " operators, "
+              << stats.branches << " conditionals and " << stats.bindings
+              << " let bindings, removed " << stats.items << " items and "
+              << stats.nodes << " nodes";
+}
+}  // namespace passes
+}  // namespace mk
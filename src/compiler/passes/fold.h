@@ -0,0 +1,94 @@
+#ifndef __FOLD_H__
+#define __FOLD_H__
+
+#include "compiler/lexer/symbol.h"
+#include "compiler/parser/ast.h"
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace mk
+{
+namespace passes
+{
+// Simplifies the tree ahead of code generation without changing what the
+// generated code computes:
+//
+//  - the builtin operators + - * < applied to literals are evaluated the way
+//    the generated code would, unary operators always call a user function
+//    and are kept
+//  - a conditional on a literal is replaced by the branch it takes
+//  - a let binding of a literal is substituted into its scope and dropped
+//    unless the item assigns the name somewhere, a let left without bindings
+//    is replaced by its body
+//  - top level expressions that fold to a literal, which generate no code,
+//    and externs that nothing refers to anymore are removed
+//
+// Errors that code generation would report for a branch that is never taken
+// are not reported.
+class Fold final : private ast::StaticVisitor<Fold>
+{
+public:
+    struct Stats
+    {
+        // Operators evaluated, conditionals replaced by a branch, let
+        // bindings substituted and top level items removed
+        std::size_t operators = 0;
+        std::size_t branches = 0;
+        std::size_t bindings = 0;
+        std::size_t items = 0;
+        // Nodes no longer reachable from the root, counted as in a tree
+        std::size_t nodes = 0;
+    };
+
+    // Makes the nodes of the evaluated literals in arena
+    Fold(ast::Arena & arena) : arena(arena) {}
+
+    // Folds the items of root in place and returns the ones left. Nodes are
+    // rewritten where they are, a shared node folds alike in every occurrence.
+    std::vector<ast::Ptr<ast::Node>>
+    operator()(const std::vector<ast::Ptr<ast::Node>> & root);
+
+    const Stats & stats() const { return counts; }
+
+private:
+    friend ast::StaticVisitor<Fold>;
+
+    void visit(ast::Variable &);
+    void visit(ast::Literal &);
+    void visit(ast::UnaryExpr &);
+    void visit(ast::BinExpr &);
+    void visit(ast::CallExpr &);
+    void visit(ast::ConditionalExpr &);
+    void visit(ast::ForExpr &);
+    void visit(ast::ProtoType &);
+    void visit(ast::Function &);
+    void visit(ast::LetExpr &);
+    void visit(ast::Extern &);
+    void visit(ast::Error &);
+
+    // Folds the expression held by expr, which may replace it
+    void fold(ast::Ptr<ast::Expr> & expr);
+    // Folds the operators of the tree held by expr after their operands, see
+    // passes::operators
+    void operators(ast::Ptr<ast::Expr> & expr);
+
+    bool substitutes(Symbol name, const ast::Ptr<ast::Expr> & value) const;
+
+    ast::Arena & arena;
+    // Holder of the expression visited, where its replacement goes
+    ast::Ptr<ast::Expr> * slot = nullptr;
+    // Both indexed by Symbol::id: the literal that replaces the name in the
+    // current scope, null when none, and whether the item assigns the name
+    std::vector<ast::Literal *> literals;
+    std::vector<bool> assigned;
+    Stats counts;
+};
+
+// Prints the statistics in one line
+std::ostream & operator<<(std::ostream & os, const Fold::Stats & stats);
+}  // namespace passes
+}  // namespace mk
+
+#endif
@@ -0,0 +1,129 @@
+#include "resolve.h"
+#include "walk.h"
+
+#include <algorithm>
+
+namespace mk
+{
+namespace passes
+{
+std::uint32_t Resolve::operator()(ast::Node & item)
+{
+    if (slots.size() < Symbol::count())
+        slots.resize(Symbol::count(), ast::unresolved);
+    frame = 0;
+    dispatch(item);
+    unbind(0);
+    return frame;
+}
+
+std::uint32_t Resolve::bind(Symbol name)
+{
+    const auto slot = static_cast<std::uint32_t>(scope.size());
+    scope.emplace_back(name, std::exchange(slots[name.id()], slot));
+    frame = std::max<std::uint32_t>(frame, scope.size());
+    return slot;
+}
+
+void Resolve::unbind(std::uint32_t slot)
+{
+    while (scope.size() > slot)
+    {
+        const auto [name, shadowed] = scope.back();
+        slots[name.id()] = shadowed;
+        scope.pop_back();
+    }
+}
+
+void Resolve::visit(ast::Variable & variable)
+{
+    variable.slot = slots[variable.name.id()];
+}
+
+void Resolve::visit(ast::Literal &) {}
+
+void Resolve::visit(ast::UnaryExpr & unary)
+{
+    operators(unary);
+}
+
+void Resolve::visit(ast::BinExpr & bin)
+{
+    operators(bin);
+}
+
+void Resolve::operators(ast::Expr & expr)
+{
+    // The walk takes a holder, nothing replaces the root
+    ast::Ptr<ast::Expr> root(&expr);
+    passes::operators(
+        root,
+        [&](ast::Ptr<ast::Expr> & operand)
+        {
+            if (operand)
+                dispatch(*operand);
+        },
+        [](ast::Ptr<ast::Expr> &) {});
+}
+
+void Resolve::visit(ast::CallExpr & call)
+{
+    for (const auto & arg : call.args)
+        if (arg)
+            dispatch(*arg);
+}
+
+void Resolve::visit(ast::ConditionalExpr & conditional)
+{
+    for (const auto expr :
+         {&conditional.condition, &conditional.first, &conditional.second})
+        if (*expr)
+            dispatch(**expr);
+}
+
+void Resolve::visit(ast::ForExpr & loop)
+{
+    if (loop.init)
+        dispatch(*loop.init);
+
+    loop.slot = bind(loop.name);
+    for (const auto expr : {&loop.condition, &loop.step, &loop.body})
+        if (*expr)
+            dispatch(**expr);
+    unbind(loop.slot);
+}
+
+void Resolve::visit(ast::LetExpr & let)
+{
+    // Each value sees the bindings before it
+    let.slot = static_cast<std::uint32_t>(scope.size());
+    for (const auto & [name, value] : let.vars)
+    {
+        if (value)
+            dispatch(*value);
+        bind(name);
+    }
+    if (let.body)
+        dispatch(*let.body);
+    unbind(let.slot);
+}
+
+void Resolve::visit(ast::ProtoType & prototype)
+{
+    for (const auto arg : prototype.args)
+        bind(arg);
+}
+
+void Resolve::visit(ast::Function & function)
+{
+    if (function.prototype)
+        dispatch(*function.prototype);
+    if (function.body)
+        dispatch(*function.body);
+}
+
+void Resolve::visit(ast::Extern &) {}
+
+void Resolve::visit(ast::Error &) {}
+}  // namespace passes
+}  // namespace mk
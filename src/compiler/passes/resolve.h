@@ -0,0 +1,61 @@
+#ifndef __RESOLVE_H__
+#define __RESOLVE_H__
+
+#include "compiler/lexer/symbol.h"
+#include "compiler/parser/ast.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mk
+{
+namespace passes
+{
+// Numbers the bindings of an item as slots of a frame and points every
+// variable at the slot of the binding it refers to, so that code generation
+// looks names up by index. Slots are handed out like a stack: the parameters
+// of a function take the first ones, every let binding and loop variable
+// takes the next free one and gives it back when its scope ends. Names that
+// nothing binds are left unresolved.
+class Resolve final : private ast::StaticVisitor<Resolve>
+{
+public:
+    // Annotates item and returns the number of slots of its frame
+    std::uint32_t operator()(ast::Node & item);
+
+private:
+    friend ast::StaticVisitor<Resolve>;
+
+    void visit(ast::Variable &);
+    void visit(ast::Literal &);
+    void visit(ast::UnaryExpr &);
+    void visit(ast::BinExpr &);
+    void visit(ast::CallExpr &);
+    void visit(ast::ConditionalExpr &);
+    void visit(ast::ForExpr &);
+    void visit(ast::ProtoType &);
+    void visit(ast::Function &);
+    void visit(ast::LetExpr &);
+    void visit(ast::Extern &);
+    void visit(ast::Error &);
+
+    // Resolves the operands of the operators under expr, see
+    // passes::operators
+    void operators(ast::Expr & expr);
+
+    // Binds name to the next free slot and returns it
+    std::uint32_t bind(Symbol name);
+    // Ends the scopes of the slots from slot on
+    void unbind(std::uint32_t slot);
+
+    // Slot bound to each name by Symbol::id, unresolved when none
+    std::vector<std::uint32_t> slots;
+    // Name of each slot in use and the slot it shadows
+    std::vector<std::pair<Symbol, std::uint32_t>> scope;
+    std::uint32_t frame = 0;
+};
+}  // namespace passes
+}  // namespace mk
+
+#endif
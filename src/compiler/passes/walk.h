@@ -0,0 +1,139 @@
+#ifndef __WALK_H__
+#define __WALK_H__
+
+#include "compiler/parser/ast.h"
+
+#include <vector>
+
+namespace mk
+{
+namespace passes
+{
+// Both walks keep an explicit stack rather than recurse, so that long chains
+// of operators cost heap memory instead of call stack.
+
+// Calls f on every node of the tree under node
+template <typename F>
+void walk(ast::Node * node, F && f)
+{
+    std::vector<ast::Node *> stack{node};
+    while (!stack.empty())
+    {
+        const auto node = stack.back();
+        stack.pop_back();
+        if (!node)
+            continue;
+
+        f(*node);
+        switch (node->kind)
+        {
+        case ast::Kind::UnaryExpr:
+            stack.push_back(static_cast<ast::UnaryExpr *>(node)->operand.get());
+            break;
+        case ast::Kind::BinExpr:
+        {
+            const auto bin = static_cast<ast::BinExpr *>(node);
+            stack.push_back(bin->rhs.get());
+            stack.push_back(bin->lhs.get());
+            break;
+        }
+        case ast::Kind::CallExpr:
+            for (const auto & arg : static_cast<ast::CallExpr *>(node)->args)
+                stack.push_back(arg.get());
+            break;
+        case ast::Kind::ConditionalExpr:
+        {
+            const auto conditional = static_cast<ast::ConditionalExpr *>(node);
+            stack.push_back(conditional->second.get());
+            stack.push_back(conditional->first.get());
+            stack.push_back(conditional->condition.get());
+            break;
+        }
+        case ast::Kind::ForExpr:
+        {
+            const auto loop = static_cast<ast::ForExpr *>(node);
+            stack.push_back(loop->body.get());
+            stack.push_back(loop->step.get());
+            stack.push_back(loop->condition.get());
+            stack.push_back(loop->init.get());
+            break;
+        }
+        case ast::Kind::LetExpr:
+        {
+            const auto let = static_cast<ast::LetExpr *>(node);
+            stack.push_back(let->body.get());
+            for (const auto & [name, value] : let->vars)
+                stack.push_back(value.get());
+            break;
+        }
+        case ast::Kind::Function:
+        {
+            const auto function = static_cast<ast::Function *>(node);
+            stack.push_back(function->body.get());
+            stack.push_back(function->prototype.get());
+            break;
+        }
+        case ast::Kind::Extern:
+            stack.push_back(static_cast<ast::Extern *>(node)->prototype.get());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Walks the tree of unary and binary expressions held by expr in post-order.
+// operand is called on each expression of the tree that is neither, null ones
+// included, and operation on each unary or binary expression after its
+// operands. Both are given the holder of the expression, they may replace it.
+template <typename Operand, typename Operation>
+void operators(ast::Ptr<ast::Expr> & expr,
+               Operand && operand,
+               Operation && operation)
+{
+    // A unary or binary expression is pushed back before its operands, ready
+    // once they are done
+    struct Task
+    {
+        ast::Ptr<ast::Expr> * expr;
+        bool ready;
+    };
+    std::vector<Task> tasks{{&expr, false}};
+
+    while (!tasks.empty())
+    {
+        const auto [expr, ready] = tasks.back();
+        tasks.pop_back();
+
+        const auto node = expr->get();
+        if (!node
+            || (node->kind != ast::Kind::BinExpr
+                && node->kind != ast::Kind::UnaryExpr))
+        {
+            operand(*expr);
+        }
+        else if (ready)
+        {
+            operation(*expr);
+        }
+        else
+        {
+            tasks.push_back({expr, true});
+            if (node->kind == ast::Kind::BinExpr)
+            {
+                const auto bin = static_cast<ast::BinExpr *>(node);
+                tasks.push_back({&bin->rhs, false});
+                tasks.push_back({&bin->lhs, false});
+            }
+            else
+            {
+                tasks.push_back(
+                    {&static_cast<ast::UnaryExpr *>(node)->operand, false});
+            }
+        }
+    }
+}
+}  // namespace passes
+}  // namespace mk
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace mk
+{
+namespace util
+{
+// Read only private mapping of a whole file, the pages are shared with the
+// page cache and every other process mapping the same file
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string & path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+
+        size = st.st_size;
+        // Empty files cannot be mapped
+        if (size)
+        {
+            data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                const int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), path);
+            }
+            // The lexer reads front to back exactly once
+            ::madvise(data, size, MADV_SEQUENTIAL);
+        }
+        // The mapping outlives the descriptor
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile && other) noexcept
+        : data(std::exchange(other.data, nullptr))
+        , size(std::exchange(other.size, 0))
+    {}
+
+    MappedFile & operator=(MappedFile && other) noexcept
+    {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        return *this;
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (data)
+            ::munmap(data, size);
+    }
+
+    std::string_view view() const
+    {
+        return {static_cast<const char *>(data), size};
+    }
+
+    operator std::string_view() const { return view(); }
+
+private:
+    void * data = nullptr;
+    std::size_t size = 0;
+};
+}  // namespace util
+}  // namespace mk
+
+#endif
@@ -5,13 +5,23 @@
 #include "compiler/lexer/lexer.h"
 #include "compiler/lexer/token.h"
 #include "compiler/parser/ast.h"
+#include "compiler/parser/document.h"
+#include "compiler/parser/flat.h"
+#include "compiler/parser/hash.h"
 #include "compiler/parser/parser.h"
+#include "compiler/parser/precedence.h"
+#include "compiler/parser/serialize.h"
 #include "compiler/parser/visitor.h"
+#include "compiler/passes/fold.h"
+#include "compiler/passes/resolve.h"
 
 #include "util/lld.h"
 #include "util/overload.h"
 
 #include "lld/Common/Driver.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
@@ -20,8 +30,13 @@
 
 #include "fmt/core.h"
 
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 
@@ -199,6 +214,256 @@ TEST(Lexer, Simple)
     ASSERT_EQ(actual, expected);
 }
 
+TEST(Lexer, Lexemes)
+{
+    using namespace mk;
+
+    const std::string code =
+        "def operator|5(l,r) r # comment\nextern sin(x)\n2.5+x 1.2.3 then";
+
+    // The tokens are copied out bytewise and the lexer destroyed, the
+    // lexemes still point into the source and the tokens borrow from neither
+    std::vector<std::pair<std::string_view, Token>> lexed;
+    {
+        Lexer lexer(code);
+        for (lexer.next(); !lexer.current().is<Empty>(); lexer.next())
+        {
+            Token token;
+            std::memcpy(static_cast<void *>(&token),
+                        static_cast<const void *>(&lexer.current()),
+                        sizeof(Token));
+            lexed.emplace_back(lexer.lexeme(), token);
+        }
+    }
+
+    const std::vector<std::pair<std::string_view, Token>> expected = {
+        {"def", {Def{}}},
+        {"operator|", {Operator{"|"}}},
+        {"5", {5.0}},
+        {"(", {static_cast<unsigned char>('(')}},
+        {"l", {Identifier{"l"}}},
+        {",", {static_cast<unsigned char>(',')}},
+        {"r", {Identifier{"r"}}},
+        {")", {static_cast<unsigned char>(')')}},
+        {"r", {Identifier{"r"}}},
+        {"extern", {Extern{}}},
+        {"sin", {Identifier{"sin"}}},
+        {"(", {static_cast<unsigned char>('(')}},
+        {"x", {Identifier{"x"}}},
+        {")", {static_cast<unsigned char>(')')}},
+        {"2.5", {2.5}},
+        {"+", {static_cast<unsigned char>('+')}},
+        {"x", {Identifier{"x"}}},
+        {"1.2.3",
+         {Invalid{"Invalid floating point number", code.find("1.2.3")}}},
+        {"then", {Then{}}},
+    };
+    ASSERT_EQ(lexed, expected);
+
+    for (const auto & [lexeme, token] : lexed)
+    {
+        ASSERT_GE(lexeme.data(), code.data());
+        ASSERT_LE(lexeme.data() + lexeme.size(), code.data() + code.size());
+    }
+}
+
+TEST(Lexer, Keywords)
+{
+    using namespace mk;
+
+    const std::vector<std::pair<std::string, Token>> keywords = {
+        {"def", {Def{}}},
+        {"extern", {Extern{}}},
+        {"if", {If{}}},
+        {"then", {Then{}}},
+        {"else", {Else{}}},
+        {"for", {For{}}},
+        {"in", {In{}}},
+        {"let", {Let{}}},
+        {"operator+", {Operator{"+"}}},
+    };
+    for (const auto & [word, token] : keywords)
+    {
+        Lexer lexer(word);
+        lexer.next();
+        ASSERT_EQ(lexer.current(), token) << word;
+        lexer.next();
+        ASSERT_TRUE(lexer.current().is<Empty>()) << word;
+    }
+
+    const std::vector<std::string> words = {
+        "def", "extern", "if", "then", "else", "for", "in", "let", "operator"};
+    for (const auto & word : words)
+        ASSERT_TRUE(Keywords::contains(word)) << word;
+
+    // Words sharing the first or last character or the length of a keyword
+    // probe its slot, but are identifiers all the same
+    std::vector<std::string> misses = {"de",      "defx",      "xdef",
+                                       "iff",     "fi",        "thn",
+                                       "tehn",    "esle",      "elsee",
+                                       "fro",     "ni",        "inn",
+                                       "lett",    "lex",       "Let",
+                                       "DEF",     "externs",   "operato",
+                                       "operators"};
+    for (const auto & word : words)
+        for (std::size_t length = 1; length < word.size(); ++length)
+        {
+            misses.push_back(word.substr(0, length));
+            misses.push_back(word.substr(length));
+        }
+
+    for (const auto & word : misses)
+    {
+        if (Keywords::contains(word))
+            continue;
+        Lexer lexer(word);
+        lexer.next();
+        ASSERT_EQ(lexer.current(), Token{Identifier{word}}) << word;
+        lexer.next();
+        ASSERT_TRUE(lexer.current().is<Empty>()) << word;
+    }
+
+    // Identifiers are alphanumeric, a keyword ends where they do
+    Lexer lexer("extern_");
+    lexer.next();
+    ASSERT_TRUE(lexer.current().is<Extern>());
+    lexer.next();
+    ASSERT_TRUE(lexer.current().is('_'));
+
+    ASSERT_FALSE(Keywords::contains(""));
+    ASSERT_FALSE(Keywords::contains("operatorx"));
+}
+
+TEST(Lexer, LongRuns)
+{
+    using namespace mk;
+
+    // Runs of every length up to a few vector blocks, so that each scan ends
+    // inside, at the edge of, and right after a 16 and 32 byte block
+    std::string code;
+    std::vector<Token> expected;
+    std::vector<std::string> names;
+    names.reserve(100);
+    for (std::size_t length = 1; length <= 100; ++length)
+    {
+        names.emplace_back(length, 'a' + length % 26);
+        names.back().back() = '0' + length % 10;
+        names.back().front() = 'Z';
+    }
+    for (std::size_t length = 1; length <= 100; ++length)
+    {
+        code += std::string(length, " \t\n\v\f\r"[length % 6]);
+        code += names[length - 1];
+        code += "#" + std::string(length, '~') + (length % 2 ? "\n" : "\r");
+        code += std::string(length, '7') + ";";
+        expected.emplace_back(Identifier{names[length - 1]});
+        expected.emplace_back(std::stod(std::string(length, '7')));
+        expected.emplace_back(static_cast<unsigned char>(';'));
+    }
+    code += "# trailing comment without a line break";
+
+    Lexer lexer(code);
+    std::vector<Token> actual;
+    for (lexer.next(); !lexer.current().is<Empty>(); lexer.next())
+        actual.push_back(lexer.current());
+
+    ASSERT_EQ(actual, expected);
+}
+
+TEST(Lexer, Numbers)
+{
+    using namespace mk;
+
+    const std::string code =
+        "42 1. 0.5 1e3 2.5E-2 6e+1 0x1F 0x1.8p1 0X1.8P-1 0.1000000000000000055 "
+        "2e x 0xg 1e400 1.2.3 7";
+
+    Lexer lexer(code);
+
+    std::vector<Token> expected = {
+        {42.0},
+        {1.0},
+        {0.5},
+        {1000.0},
+        {0.025},
+        {60.0},
+        {31.0},
+        {3.0},
+        {0.75},
+        {0.1},
+        {2.0},
+        {Identifier{"e"}},
+        {Identifier{"x"}},
+        {0.0},
+        {Identifier{"xg"}},
+        {Invalid{"Floating point number out of range", code.find("1e400")}},
+        {Invalid{"Invalid floating point number", code.find("1.2.3")}},
+        {7.0},
+    };
+
+    std::vector<Token> actual;
+    for (lexer.next(); !lexer.current().is<Empty>(); lexer.next())
+        actual.push_back(lexer.current());
+
+    ASSERT_EQ(actual, expected);
+}
+
+TEST(Lexer, Stream)
+{
+    using namespace mk;
+
+    const std::string code = R"CODE(
+        # a comment that is longer than a chunk
+        def operator  |5(l,r) if (l) then 1 else r
+        extern a_rather_long_identifier(x)
+        def f(x) 1e+5 + 0x1.8p1 + 2.5E-1 + 12e + 1..2 # trailing
+        1 @ x)CODE";
+
+    std::vector<Token> expected;
+    Lexer lexer(code);
+    for (lexer.next(); !lexer.current().is<Empty>(); lexer.next())
+        expected.push_back(lexer.current());
+
+    for (std::size_t chunk = 1; chunk <= code.size(); ++chunk)
+    {
+        std::istringstream stream(code);
+        Lexer lexer(stream, chunk);
+        for (const auto & token : expected)
+        {
+            lexer.next();
+            ASSERT_EQ(token, lexer.current()) << chunk;
+        }
+        lexer.next();
+        ASSERT_TRUE(lexer.current().is<Empty>()) << chunk;
+        ASSERT_EQ(code.size(), lexer.offset()) << chunk;
+    }
+}
+
+TEST(Lexer, Symbols)
+{
+    using namespace mk;
+
+    const std::string name = "aSymbolName";
+    const Symbol symbol(name);
+
+    ASSERT_EQ(symbol, Symbol(std::string(name)));
+    ASSERT_NE(symbol, Symbol("anotherSymbolName"));
+    ASSERT_EQ(symbol, name);
+    ASSERT_NE(symbol.str().data(), name.data());
+    ASSERT_LT(symbol.id(), Symbol::count());
+
+    ASSERT_EQ(Symbol("+").id(), '+');
+    ASSERT_EQ(Symbol('+').str(), "+");
+    ASSERT_EQ(Symbol(""), Symbol());
+    ASSERT_EQ(Symbol().str(), "");
+
+    Lexer lexer("aSymbolName operator <=");
+    lexer.next();
+    ASSERT_EQ(lexer.current(), Token(Identifier(symbol)));
+    lexer.next();
+    ASSERT_EQ(lexer.current(), Token(Operator("<=")));
+}
+
 class TestVisitor : public mk::ast::Visitor
 {
 private:
@@ -383,6 +648,815 @@ else
     ASSERT_EQ(expected, ss.str());
 }
 
+TEST(Parser, TokenStream)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        extern sin(x)
+        def operator|5(l,r) if (l) then 1 else r
+        def f(a) let x = 0x10 in sin(a) | x * 2.5e1
+    )CODE";
+
+    Lexer streaming(code);
+    const auto tokens = Lexer(code).tokenize();
+
+    for (std::size_t i = 0; i <= tokens.size(); ++i)
+    {
+        streaming.next();
+        ASSERT_EQ(streaming.current(), tokens[i]) << i;
+    }
+
+    const auto print = [](Parser & parser)
+    {
+        std::stringstream ss;
+        TestVisitor visitor(ss);
+        for (auto & node : parser.parse())
+        {
+            if (node)
+            {
+                node->accept(visitor);
+                ss << "\n";
+            }
+        }
+        return ss.str();
+    };
+
+    Lexer lexer(code);
+    Parser lhs(lexer);
+    const auto expected = print(lhs);
+
+    Parser rhs(tokens);
+    ASSERT_EQ(expected, print(rhs));
+
+    std::istringstream stream(code);
+    Lexer chunked(stream, 7);
+    Parser streamed(chunked);
+    ASSERT_EQ(expected, print(streamed));
+}
+
+TEST(Parser, Parallel)
+{
+    using namespace mk;
+
+    std::string code = R"CODE(
+        1 + 2
+        def operator|5(l,r) if (l) then 1 else r
+        def a(x) x | 1 * 2
+        extern operator&100(l,r)
+        def b(x) x & x | x
+        3 | 4 & 5
+        def operator^1(l, r) r
+        def [fast, nsz] operator%3(l, r) l - r
+    )CODE";
+    for (int i = 0; i < 100; ++i)
+        code += fmt::format("def f{}(x) x ^ x + {} | x & x % x * 2\n", i, i);
+
+    const auto print = [](const std::vector<ast::Ptr<ast::Node>> & nodes)
+    {
+        std::stringstream ss;
+        TestVisitor visitor(ss);
+        for (auto & node : nodes)
+        {
+            if (node)
+            {
+                node->accept(visitor);
+                ss << "\n";
+            }
+        }
+        return ss.str();
+    };
+
+    const auto tokens = Lexer(code).tokenize();
+
+    Parser sequential(tokens);
+    const auto expected = print(sequential.parse());
+
+    ASSERT_TRUE(sequential.diagnostics().empty());
+
+    for (const auto grain : {1, 7, 1 << 14})
+    {
+        Parser parallel(tokens);
+        ASSERT_EQ(expected, print(parallel.parse_parallel(4, grain))) << grain;
+        ASSERT_TRUE(parallel.diagnostics().empty()) << grain;
+    }
+}
+
+TEST(Parser, Precedence)
+{
+    using namespace mk;
+
+    Precedence precedence({{Symbol('+'), 20}});
+    const auto snapshot = precedence.snapshot();
+
+    precedence.push(Symbol('+'), 50);
+    precedence.push(Symbol('|'), 5);
+    precedence.push(Symbol("<=>"), 15);
+
+    ASSERT_EQ(precedence.get(Symbol('+')), 20);
+    ASSERT_EQ(precedence.get(Symbol('|')), 5);
+    ASSERT_EQ(precedence.get(Symbol("<=>")), 15);
+    ASSERT_EQ(precedence.get(Symbol("=>")), std::nullopt);
+    ASSERT_EQ(precedence.get(std::nullopt), std::nullopt);
+
+    // Published tables do not change
+    ASSERT_EQ(snapshot->bytes['|'], Precedence::Table::absent);
+
+    Precedence copy(precedence.snapshot());
+    copy.push(Symbol('&'), 7);
+    ASSERT_EQ(copy.get(Symbol('&')), 7);
+    ASSERT_EQ(copy.get(Symbol("<=>")), 15);
+    ASSERT_EQ(precedence.get(Symbol('&')), std::nullopt);
+}
+
+TEST(Parser, Flat)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        extern bar(a)
+        def foo(x) let y = 2 in bar(x) + -y
+        def baz() for i = 1, i < 3 in i
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto tree = ast::flat::flatten(parser.parse());
+
+    for (std::uint32_t i = 0; i < tree.nodes.size(); ++i)
+        for (const auto child : tree.children_of(i))
+            ASSERT_TRUE(child == ast::flat::none || child < i);
+
+    ASSERT_EQ(tree.item(1), std::pair(3u, 14u));
+
+    std::stringstream ss;
+    ss << tree;
+
+    const std::string expected = R"(0: Param a
+1: ProtoType bar 0
+2: Extern 1
+3: Param x
+4: ProtoType foo 3
+5: Literal 2
+6: Binding y 5
+7: Variable x
+8: CallExpr bar 7
+9: Variable y
+10: UnaryExpr - 9
+11: BinExpr + 8 10
+12: LetExpr 6 11
+13: Function 4 12
+14: ProtoType baz
+15: Literal 1
+16: Variable i
+17: Literal 3
+18: BinExpr < 16 17
+19: Variable i
+20: ForExpr i 15 18 - 19
+21: Function 14 20
+roots: 2 13 21
+)";
+
+    ASSERT_EQ(expected, ss.str());
+
+    // A missing item comes back as a null one
+    auto missing = tree;
+    missing.roots[1] = ast::flat::none;
+    ast::Arena arena;
+    const auto root = ast::flat::unflatten(missing, arena);
+    ASSERT_EQ(root.size(), 3u);
+    ASSERT_NE(root[0], nullptr);
+    ASSERT_EQ(root[1], nullptr);
+    ASSERT_NE(root[2], nullptr);
+}
+
+TEST(Parser, Serialize)
+{
+    using namespace mk;
+
+    const std::string code = R"CODE(
+        extern bar(a)
+        def foo(x) let y = 2, z = 1.5 in bar(x) + -y * z
+        def baz() for i = 1, i < 3 in if (i) then i else 0
+        def broken(x) 1 +
+        def operator|5(l, r) l
+        def [nnan, contract] fma(a b c) a * b + c
+    )CODE";
+
+    const auto tokens = Lexer(code).tokenize();
+    Parser parser(tokens);
+    const auto tree = ast::flat::flatten(parser.parse());
+    ASSERT_EQ(tree.nodes[tree.roots.back()].flags,
+              static_cast<std::uint8_t>(ast::FastMath::nnan
+                                        | ast::FastMath::contract));
+    const auto print = [](const ast::flat::Tree & tree)
+    {
+        std::stringstream ss;
+        ss << tree;
+        return ss.str();
+    };
+
+    const auto fingerprint = ast::flat::fingerprint(code);
+    const auto data = ast::flat::serialize(tree, fingerprint);
+
+    const auto loaded = ast::flat::deserialize(data, fingerprint);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(print(tree), print(*loaded));
+
+    ast::Arena arena;
+    ASSERT_EQ(print(tree),
+              print(ast::flat::flatten(ast::flat::unflatten(*loaded, arena))));
+
+    ASSERT_NE(fingerprint, ast::flat::fingerprint(code + " "));
+    ASSERT_FALSE(ast::flat::deserialize(data, fingerprint + 1));
+    ASSERT_FALSE(ast::flat::deserialize(data.substr(0, data.size() - 1),
+                                        fingerprint));
+    ASSERT_FALSE(ast::flat::deserialize(data + '\0', fingerprint));
+
+    // Roots out of order
+    auto unordered = data;
+    std::fill(unordered.end() - 4, unordered.end(), '\0');
+    ASSERT_FALSE(ast::flat::deserialize(unordered, fingerprint));
+}
+
+TEST(Parser, Sharing)
+{
+    using namespace mk;
+
+    const std::string code = R"CODE(
+        def f(x) x + (1 + 2) * 3
+        def g(y) (1 + 2) * 3 - y
+        def h() foo(1 + 2)
+        def a(x) x + 1
+        def b(x) x + 1
+    )CODE";
+
+    const auto tokens = Lexer(code).tokenize();
+    Parser parser(tokens);
+    parser.share();
+    const auto & root = parser.parse();
+
+    const auto body = [&](std::size_t i)
+    { return static_cast<ast::BinExpr *>(
+          static_cast<ast::Function &>(*root[i]).body.get()); };
+    ASSERT_EQ(body(0)->rhs, body(1)->lhs);
+    const auto & call = static_cast<ast::CallExpr &>(
+        *static_cast<ast::Function &>(*root[2]).body);
+    ASSERT_EQ(static_cast<ast::BinExpr &>(*body(0)->rhs).lhs, call.args[0]);
+    ASSERT_NE(body(3), body(4));
+    ASSERT_EQ(body(3)->rhs, body(4)->rhs);
+
+    const auto report = parser.sharing();
+    ASSERT_EQ(report.closed, 16);
+    ASSERT_EQ(report.shared, 10);
+    std::stringstream ss;
+    ss << report;
+    ASSERT_EQ(ss.str(),
+              fmt::format("shared 10 of 16 closed expressions, {} bytes saved",
+                          report.bytes));
+
+    // Sharing changes nothing but the number of nodes
+    const auto print = [](const ast::flat::Tree & tree)
+    {
+        std::stringstream ss;
+        ss << tree;
+        return ss.str();
+    };
+    Parser plain(tokens);
+    ASSERT_EQ(print(ast::flat::flatten(root)),
+              print(ast::flat::flatten(plain.parse())));
+}
+
+TEST(Parser, Hash)
+{
+    using namespace mk;
+
+    const auto hash = [](const std::string & code)
+    {
+        Lexer lexer(code);
+        Parser parser(lexer);
+        return ast::flat::hashes(ast::flat::flatten(parser.parse()));
+    };
+
+    const auto f = hash("def f(x) x * (1 + 2)");
+    const auto g = hash("def g(x) x * (1 + 2)");
+    // Param, ProtoType, Variable, Literal, Literal, BinExpr, BinExpr, Function
+    ASSERT_EQ(f.size(), 8);
+    ASSERT_EQ(f[0], g[0]);
+    ASSERT_NE(f[1], g[1]);
+    ASSERT_EQ(std::vector(f.cbegin() + 2, f.cend() - 1),
+              std::vector(g.cbegin() + 2, g.cend() - 1));
+    ASSERT_NE(f.back(), g.back());
+    ASSERT_NE(f[3], f[4]);
+    ASSERT_NE(hash("def f(x) x * (2 + 1)").back(), f.back());
+    ASSERT_NE(hash("def f(x) x * (1 - 2)").back(), f.back());
+    ASSERT_NE(hash("def f(x, y) x * (1 + 2)").back(), f.back());
+    ASSERT_NE(hash("def [fast] f(x) x * (1 + 2)").back(), f.back());
+
+    // The same in every process
+    ASSERT_EQ(f.back(), 11889376239784647416u);
+}
+
+TEST(Parser, Document)
+{
+    using namespace mk;
+
+    const auto print = [](const std::vector<ast::Ptr<ast::Node>> & root)
+    {
+        std::stringstream ss;
+        ss << ast::flat::flatten(root);
+        return ss.str();
+    };
+    const auto parse = [&](const std::string & code)
+    {
+        const auto tokens = Lexer(code).tokenize();
+        Parser parser(tokens);
+        return print(parser.parse());
+    };
+
+    Document document(R"CODE(
+        extern sin(x)
+        def operator|5(l,r) if (l) then 1 else r
+        def a(x) x | 1 * 2
+        def b(x) x * x
+        def c(x) a(x) | b(x)
+        c(1)
+    )CODE");
+    ASSERT_EQ(parse(document.text()), print(document.root()));
+
+    const auto edit = [&](std::string_view from,
+                          std::string_view to,
+                          std::size_t first,
+                          std::size_t removed,
+                          std::size_t inserted)
+    {
+        std::vector<const ast::Node *> before;
+        for (const auto & node : document.root())
+            before.push_back(node.get());
+
+        const auto change = document.edit(
+            document.text().find(from), from.size(), to);
+        ASSERT_EQ(parse(document.text()), print(document.root())) << to;
+        ASSERT_EQ(change.first, first) << to;
+        ASSERT_EQ(change.removed, removed) << to;
+        ASSERT_EQ(change.inserted, inserted) << to;
+
+        // Items outside of the change are reused
+        const auto & root = document.root();
+        for (std::size_t i = 0; i < first; ++i)
+            ASSERT_EQ(root[i].get(), before[i]) << to;
+        for (std::size_t i = first + inserted; i < root.size(); ++i)
+            ASSERT_EQ(root[i].get(), before[i - inserted + removed]) << to;
+    };
+
+    // Only b is parsed again
+    edit("x * x", "x * x - 1", 3, 1, 1);
+    // A new def splits the chunk it is inserted into
+    edit("x * x - 1", "x\n        def d(y) y", 3, 1, 2);
+    // Removing a def merges its items into the previous chunk
+    edit("def d", "d", 3, 2, 3);
+    edit("x\n        d(y) y", "x", 3, 3, 1);
+    // A new precedence changes the parse of every later use
+    edit("|5", "|50", 1, 5, 5);
+    // Edits at both ends
+    edit("extern", "1 extern", 0, 1, 2);
+    edit("c(1)", "c(2) * 3", 5, 2, 2);
+
+    // Random edits, half of them inside the keywords that start chunks,
+    // against a parse of the whole text
+    const std::string pieces[] = {"def",        "extern", "d",     "xtern",
+                                  "e",          " ",      "\n",    "(",
+                                  ")",          "x",      "1",     "+",
+                                  "*",          "|",      "(l,r)", "if",
+                                  "then",       "else",   "#",     "f(x) x",
+                                  "g(x y) y",   "operator|3"};
+    for (std::uint32_t seed = 0; seed < 200; ++seed)
+    {
+        std::mt19937 random(seed);
+        const auto pick = [&](std::size_t n)
+        {
+            return std::uniform_int_distribution<std::size_t>(0, n - 1)(
+                random);
+        };
+
+        Document document(R"CODE(
+        def operator|5(l,r) l + r
+        def f(x) x | 1
+        def g(x y) ) x
+        extern h(x)
+        def k(x) f(x) * extern
+        )CODE");
+        for (int i = 0; i < 30; ++i)
+        {
+            const auto & text = document.text();
+            auto offset = pick(text.size() + 1);
+            const auto keyword = text.find(pick(2) ? "def" : "extern", offset);
+            if (pick(2) && keyword != std::string::npos)
+                offset = keyword + pick(4);
+            const auto length = pick(std::min<std::size_t>(
+                                    text.size() - offset, 8) + 1);
+            std::string replacement;
+            for (auto n = pick(3); n; --n)
+                replacement += pieces[pick(std::size(pieces))];
+            document.edit(offset, length, replacement);
+
+            const auto tokens = Lexer(document.text()).tokenize();
+            Parser parser(tokens);
+            ASSERT_EQ(print(parser.parse()), print(document.root()))
+                << seed << ": " << document.text();
+            ASSERT_EQ(parser.diagnostics(), document.diagnostics())
+                << seed << ": " << document.text();
+        }
+    }
+}
+
+namespace mk
+{
+void PrintTo(const Diagnostic & diagnostic, std::ostream * os)
+{
+    *os << diagnostic.offset << ": " << diagnostic.message;
+}
+}  // namespace mk
+
+TEST(Parser, Recovery)
+{
+    using namespace mk;
+
+    const std::string code = R"CODE(
+        extern sin(x)
+        def f(x) (x + 1
+        def g(x) x * 2
+        def h(x, 1) x
+        def e(x) 1 + then 2
+        def k(x) 1.2.3 + x
+        def l(x) if x then 1 else 2
+        def m(x) g(x) + 1
+    )CODE"
+        // Bytes above ASCII are no operators whatever the locale
+        "        def p(x) \xe9x\n"
+        R"CODE(
+        def [fast fma] n(x) x
+        def [fast] o(x) x
+    )CODE";
+
+    const std::vector<Diagnostic> expected = {
+        {code.find("def g"), "expected ')'"},
+        {code.find("1) x"), "expected a parameter or ')'"},
+        {code.find("then 2"), "expected an expression"},
+        {code.find("1.2.3"), "Invalid floating point number"},
+        {code.find("x then"), "expected '(' after if"},
+        {code.find("\xe9x"), "expected an expression"},
+        {code.find("fma]"), "expected a fast-math flag or ']'"},
+    };
+
+    const auto print = [](const std::vector<ast::Ptr<ast::Node>> & root)
+    {
+        std::stringstream ss;
+        ss << ast::flat::flatten(root);
+        return ss.str();
+    };
+
+    Lexer lexer(code);
+    Parser streaming(lexer);
+    const auto & root = streaming.parse();
+    ASSERT_EQ(streaming.diagnostics(), expected);
+
+    // Broken items are replaced, valid ones are kept
+    std::vector<bool> broken;
+    for (const auto & node : root)
+        broken.push_back(dynamic_cast<const ast::Error *>(node.get()));
+    ASSERT_EQ(broken,
+              std::vector<bool>({false,
+                                 true,
+                                 false,
+                                 true,
+                                 true,
+                                 true,
+                                 true,
+                                 false,
+                                 true,
+                                 true,
+                                 false}));
+
+    const auto tokens = Lexer(code).tokenize();
+    for (const auto grain : {1, 1 << 14})
+    {
+        Parser parallel(tokens);
+        ASSERT_EQ(print(root), print(parallel.parse_parallel(4, grain)));
+        ASSERT_EQ(parallel.diagnostics(), expected);
+    }
+
+    Document document(code);
+    ASSERT_EQ(print(root), print(document.root()));
+    ASSERT_EQ(document.diagnostics(), expected);
+
+    CodeGen codegen(root);
+    const auto module = codegen();
+    ASSERT_TRUE(codegen.errors().empty());
+    ASSERT_NE(module->getFunction("g"), nullptr);
+    ASSERT_NE(module->getFunction("m"), nullptr);
+    ASSERT_EQ(module->getFunction("f"), nullptr);
+    ASSERT_EQ(static_cast<const ast::Function &>(*root.back()).math,
+              ast::FastMath::fast);
+}
+
+TEST(Parser, Depth)
+{
+    using namespace mk;
+
+    // Deep nesting followed by a long chain of operators
+    std::string code = "def operator!(v) 0 - v\ndef f(x) ";
+    for (int i = 0; i < 2000; ++i)
+        code += "!(";
+    code += "x" + std::string(2000, ')');
+    for (int i = 0; i < 20000; ++i)
+        code += " + x";
+    const auto tokens = Lexer(code).tokenize();
+
+    Parser parser(tokens);
+    const auto & root = parser.parse();
+    ASSERT_TRUE(parser.diagnostics().empty());
+
+    CodeGen codegen(root);
+    const auto module = codegen();
+    ASSERT_TRUE(codegen.errors().empty());
+    ASSERT_NE(module->getFunction("f"), nullptr);
+
+    Parser limited(tokens, 1000);
+    limited.parse();
+    // Each !( nests twice
+    const Diagnostic expected{code.find("!(!(") + 1000,
+                              "expression nested too deeply"};
+    ASSERT_EQ(limited.diagnostics(), std::vector<Diagnostic>({expected}));
+}
+
+TEST(Parser, StaticVisitor)
+{
+    using namespace mk;
+
+    // Checks that every node reaches the overload of its kind
+    class Kinds final : public ast::StaticVisitor<Kinds>
+    {
+    public:
+        void visit(ast::Variable & node) { check(node, ast::Kind::Variable); }
+        void visit(ast::Literal & node) { check(node, ast::Kind::Literal); }
+        void visit(ast::UnaryExpr & node)
+        {
+            check(node, ast::Kind::UnaryExpr);
+            dispatch(*node.operand);
+        }
+        void visit(ast::BinExpr & node)
+        {
+            check(node, ast::Kind::BinExpr);
+            dispatch(*node.lhs);
+            dispatch(*node.rhs);
+        }
+        void visit(ast::CallExpr & node)
+        {
+            check(node, ast::Kind::CallExpr);
+            for (auto & arg : node.args)
+                dispatch(*arg);
+        }
+        void visit(ast::ConditionalExpr & node)
+        {
+            check(node, ast::Kind::ConditionalExpr);
+            dispatch(*node.condition);
+            dispatch(*node.first);
+            dispatch(*node.second);
+        }
+        void visit(ast::ForExpr & node)
+        {
+            check(node, ast::Kind::ForExpr);
+            dispatch(*node.body);
+        }
+        void visit(ast::LetExpr & node)
+        {
+            check(node, ast::Kind::LetExpr);
+            dispatch(*node.body);
+        }
+        void visit(ast::ProtoType & node)
+        {
+            check(node, ast::Kind::ProtoType);
+        }
+        void visit(ast::Function & node)
+        {
+            check(node, ast::Kind::Function);
+            dispatch(*node.prototype);
+            dispatch(*node.body);
+        }
+        void visit(ast::Extern & node)
+        {
+            check(node, ast::Kind::Extern);
+            dispatch(*node.prototype);
+        }
+        void visit(ast::Error & node) { check(node, ast::Kind::Error); }
+
+        void check(const ast::Node & node, ast::Kind kind)
+        {
+            ASSERT_EQ(node.kind, kind);
+            ++count;
+        }
+
+        std::size_t count = 0;
+    };
+
+    const auto code = R"CODE(
+        extern sin(x)
+        def operator!(v) 0 - v
+        def f(x) let y = 1 in for i = 0, i < x in if (!y) then sin(i) else 2
+        def g(x) x +
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    Kinds kinds;
+    for (const auto & node : parser.parse())
+        kinds.dispatch(*node);
+    ASSERT_EQ(kinds.count, 18);
+}
+
+TEST(Passes, Fold)
+{
+    using namespace mk;
+
+    std::string code = R"CODE(
+        extern sin(x)
+        extern cos(x)
+        def f(x) let y = 2 z = 3 in if (1 < 2) then y * z + x else sin(x)
+        def g(x) let a = 1 b = 2 in (a = a + x) + b
+        1 + 2
+        def h() 1
+    )CODE";
+    // Folds without recursing on long chains
+    for (int i = 1; i < 1000; ++i)
+        code += " + 1";
+
+    const auto print = [](const std::vector<ast::Ptr<ast::Node>> & root)
+    {
+        std::stringstream ss;
+        ss << ast::flat::flatten(root);
+        return ss.str();
+    };
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    ast::Arena arena;
+    passes::Fold fold(arena);
+    const auto items = fold(parser.parse());
+
+    Lexer folded_lexer(R"CODE(
+        def f(x) 6 + x
+        def g(x) let a = 1 in (a = a + x) + 2
+        def h() 1000
+    )CODE");
+    Parser folded(folded_lexer);
+    ASSERT_EQ(print(items), print(folded.parse()));
+
+    const auto & stats = fold.stats();
+    ASSERT_EQ(stats.operators, 1002);
+    ASSERT_EQ(stats.branches, 1);
+    ASSERT_EQ(stats.bindings, 3);
+    ASSERT_EQ(stats.items, 3);
+    ASSERT_EQ(stats.nodes, 2017);
+    std::stringstream ss;
+    ss << stats;
+    ASSERT_EQ(ss.str(),
+              "folded 1002 operators, 1 conditionals and 3 let bindings, "
+              "removed 3 items and 2017 nodes");
+}
+
+TEST(Passes, Resolve)
+{
+    using namespace mk;
+
+    // Prints the slot of every variable and the first slot of every binding
+    // in source order
+    struct Slots : ast::StaticVisitor<Slots>
+    {
+        void print(std::string_view what, std::uint32_t slot)
+        {
+            ss << what;
+            if (slot == ast::unresolved)
+                ss << '?';
+            else
+                ss << slot;
+            ss << ' ';
+        }
+
+        void visit(ast::Variable & variable)
+        {
+            print(variable.name.str(), variable.slot);
+        }
+        void visit(ast::Literal &) {}
+        void visit(ast::UnaryExpr & unary) { dispatch(*unary.operand); }
+        void visit(ast::BinExpr & bin)
+        {
+            dispatch(*bin.lhs);
+            dispatch(*bin.rhs);
+        }
+        void visit(ast::CallExpr & call)
+        {
+            for (const auto & arg : call.args)
+                dispatch(*arg);
+        }
+        void visit(ast::ConditionalExpr & conditional)
+        {
+            dispatch(*conditional.condition);
+            dispatch(*conditional.first);
+            dispatch(*conditional.second);
+        }
+        void visit(ast::ForExpr & loop)
+        {
+            print("for", loop.slot);
+            dispatch(*loop.init);
+            dispatch(*loop.condition);
+            dispatch(*loop.body);
+        }
+        void visit(ast::LetExpr & let)
+        {
+            print("let", let.slot);
+            for (const auto & [name, value] : let.vars)
+                dispatch(*value);
+            dispatch(*let.body);
+        }
+        void visit(ast::ProtoType &) {}
+        void visit(ast::Function & function) { dispatch(*function.body); }
+        void visit(ast::Extern &) {}
+        void visit(ast::Error &) {}
+
+        std::stringstream ss;
+    };
+
+    Lexer lexer(R"CODE(
+        def f(x, y)
+            (let a = x in let x = a in x)
+                + (for i = y, i < 3 in let b = i in b) + z
+    )CODE");
+    Parser parser(lexer);
+    auto & function = *parser.parse().front();
+
+    // Sibling scopes reuse the slots of the ones before them
+    passes::Resolve resolve;
+    ASSERT_EQ(resolve(function), 4);
+    Slots slots;
+    slots.dispatch(function);
+    ASSERT_EQ(slots.ss.str(), "let2 x0 let3 a2 x3 for2 y1 i2 let3 i2 b3 z? ");
+
+    std::visit(util::Overload([](int32_t x) { ASSERT_EQ(x, 10); },
+                              [](...) { FAIL(); }),
+               Driver()(R"CODE(
+                    def f(x)
+                        (let a = x in let x = a + 1 in x)
+                            + (let b = x * 2 in b)
+                    def main() f(3)
+                )CODE",
+                        Driver::Execute{}));
+}
+
+TEST(CodeGen, Released)
+{
+    using namespace mk;
+
+    std::string code = R"CODE(
+        def operator|5(l,r) if (l) then 1 else r
+        def square(x) x * x
+        def main() let y = 2 + 3 in square(y) | 0
+    )CODE";
+    for (int i = 0; i < 50; ++i)
+        code += fmt::format("def f{}(x) (x + {} * 2) | square(x)\n", i, i);
+
+    const auto generate = [](const std::vector<ast::Ptr<ast::Node>> & root)
+    {
+        ast::Arena arena;
+        passes::Fold fold(arena);
+        const auto items = fold(root);
+        CodeGen codegen(items);
+        std::string ir;
+        llvm::raw_string_ostream os(ir);
+        codegen()->print(os, nullptr);
+        EXPECT_TRUE(codegen.errors().empty());
+        return ir;
+    };
+
+    const auto tokens = Lexer(code).tokenize();
+    Parser parser(tokens);
+    const auto expected = generate(parser.parse());
+
+    // Nodes are walked, folded and generated once the parser and the tokens
+    // it read are gone, the arenas that own them are all that is left
+    Parsed parsed;
+    {
+        const auto tokens = Lexer(code).tokenize();
+        Parser parser(tokens);
+        parser.parse_parallel(4, 7);
+        ASSERT_TRUE(parser.diagnostics().empty());
+        parsed = std::move(parser).release();
+    }
+    ASSERT_EQ(parsed.arenas.size(), 4u);
+    ASSERT_EQ(parsed.root.size(), 53u);
+    ASSERT_EQ(generate(parsed.root), expected);
+}
+
 TEST(CodeGen, Simple)
 {
     using namespace mk;
@@ -444,11 +1518,11 @@ ifcont:                                           ; preds = %else, %then
   br label %loop
 
 loop:                                             ; preds = %loop, %ifcont
-  %i.0 = phi double [ 0.000000e+00, %ifcont ], [ %next, %loop ]
-  %calltmp25 = call double @bar(double %a, double %b)
-  %next = fadd double %i.0, 2.000000e+00
-  %cmptmp28 = fcmp ult double %i.0, 1.000000e+01
-  br i1 %cmptmp28, label %loop, label %after
+  %counter = phi i32 [ 0, %ifcont ], [ %next, %loop ]
+  %calltmp26 = call double @bar(double %a, double %b)
+  %next = add nuw nsw i32 %counter, 2
+  %condition = icmp ult i32 %counter, 10
+  br i1 %condition, label %loop, label %after
 
 after:                                            ; preds = %loop
   %addtmp = fadd double %a, 6.000000e+00
@@ -458,8 +1532,8 @@ after:                                            ; preds = %loop
   %multmp = fmul double %calltmp, %"&"
   %addtmp9 = fadd double %addtmp6, %multmp
   %addtmp22 = fadd double %addtmp9, %iftmp
-  %addtmp30 = fadd double %addtmp22, 0.000000e+00
-  ret double %addtmp30
+  %addtmp27 = fadd double %addtmp22, 0.000000e+00
+  ret double %addtmp27
 }
 
 define i32 @main() {
@@ -473,6 +1547,213 @@ entry:
     ASSERT_EQ(expected, actual);
 }
 
+TEST(CodeGen, SSA)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        extern bar(a,b)
+        def operator:1(l,r) r
+        def f(a, b)
+            let s = 0 t = 1 in
+                (for i = 0, i < a in
+                    (for j = 0, j < b in
+                        if (j < i) then s = s + j else t = t * 2 + s)
+                    : (s = s + t))
+                : (if (s < 3) then (a = a + 1) else (b = s))
+                : a + b + s + t + bar(s, let s = t in s)
+        def g(x) let y = x in if (x < 1) then y else (let x = y * 2 in x + y)
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto & root = parser.parse();
+
+    // Both modes optimize to the same instructions, SSA form without any
+    // stack slot to promote
+    CodeGen stack(root);
+    CodeGen ssa(root, {.ssa = true});
+    const auto expected = stack();
+    const auto actual = ssa();
+    ASSERT_TRUE(ssa.errors().empty());
+    ASSERT_FALSE(llvm::verifyModule(*actual, &llvm::errs()));
+    for (const auto & function : *actual)
+    {
+        ASSERT_EQ(function.getInstructionCount(),
+                  expected->getFunction(function.getName())
+                      ->getInstructionCount());
+        for (const auto & block : function)
+            for (const auto & instruction : block)
+                ASSERT_FALSE(llvm::isa<llvm::AllocaInst>(instruction));
+    }
+}
+
+TEST(CodeGen, FailingLoop)
+{
+    using namespace mk;
+
+    // There is no unary minus, the condition, the step and the body fail
+    const auto code = R"CODE(
+        def f(a b) let s = 0 in (for i = 0, i < -10, 1 in s = s + i) + s
+        def g(a) let s = 0 in (for i = 0, i < a, -1 in s = s + i) + s
+        def h(a) let s = 0 in (for i = 0, i < 10, 1 in s = -i) + s
+        def k(a) a
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto & root = parser.parse();
+
+    for (const auto ssa : {false, true})
+        for (const auto level : {OptLevel::O0, OptLevel::O1, OptLevel::O3})
+        {
+            CodeGen codegen(root, {.ssa = ssa, .level = level});
+            const auto module = codegen();
+            ASSERT_EQ(codegen.errors().size(), 3u);
+            ASSERT_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+            ASSERT_EQ(module->getFunction("f"), nullptr);
+            ASSERT_EQ(module->getFunction("g"), nullptr);
+            ASSERT_EQ(module->getFunction("h"), nullptr);
+            ASSERT_NE(module->getFunction("k"), nullptr);
+        }
+}
+
+TEST(CodeGen, IPO)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        extern bar(x)
+        def operator&10(l,r) l * r
+        def unused(x) x + 1
+        def square(x) x & x
+        def twice(x) x * 2
+        def main() square(twice(3)) + bar(twice(4))
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto & root = parser.parse();
+
+    // The helpers are inlined into main, the constants folded, and every
+    // other function removed once internal
+    CodeGen codegen(root, {.ipo = CodeGen::IPO{.internalize = true}});
+    const auto module = codegen();
+    ASSERT_TRUE(codegen.errors().empty());
+    ASSERT_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    std::vector<std::string> defined;
+    for (const auto & function : *module)
+        if (!function.isDeclaration())
+            defined.emplace_back(function.getName());
+    ASSERT_EQ(defined, std::vector<std::string>{"main"});
+    ASSERT_EQ(codegen.stats().before.functions, 5u);
+    ASSERT_EQ(codegen.stats().after.functions, 1u);
+    ASSERT_LT(codegen.stats().after.instructions,
+              codegen.stats().before.instructions);
+
+    std::ostringstream os;
+    os << codegen.stats();
+    ASSERT_EQ(os.str(),
+              fmt::format("{} instructions in 5 functions before module "
+                          "passes, {} in 1 after",
+                          codegen.stats().before.instructions,
+                          codegen.stats().after.instructions));
+
+    // Without internalizing every function stays visible
+    CodeGen visible(root, {.ipo = CodeGen::IPO{.threshold = 0}});
+    visible();
+    ASSERT_EQ(visible.stats().after.functions, 5u);
+}
+
+TEST(CodeGen, FastMath)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        def strict(a b) a * b + a
+        def [reassoc nsz] relaxed(a b) a * b + a
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto & root = parser.parse();
+
+    // Flags of the floating point instructions as printed in IR
+    const auto flags = [](const llvm::Function & function)
+    {
+        std::vector<std::string> flags;
+        for (const auto & block : function)
+            for (const auto & instruction : block)
+                if (llvm::isa<llvm::FPMathOperator>(instruction))
+                {
+                    llvm::raw_string_ostream os(flags.emplace_back());
+                    instruction.getFastMathFlags().print(os);
+                }
+        return flags;
+    };
+
+    CodeGen codegen(root, {.level = OptLevel::O0});
+    const auto module = codegen();
+    ASSERT_EQ(flags(*module->getFunction("strict")),
+              std::vector<std::string>(2));
+    ASSERT_EQ(flags(*module->getFunction("relaxed")),
+              std::vector<std::string>(2, " reassoc nsz"));
+    ASSERT_TRUE(module->getFunction("relaxed")->hasFnAttribute(
+        "no-signed-zeros-fp-math"));
+    ASSERT_FALSE(
+        module->getFunction("relaxed")->hasFnAttribute("unsafe-fp-math"));
+
+    // The flags of the compilation apply to every function
+    CodeGen fast(root, {.level = OptLevel::O0, .math = ast::FastMath::fast});
+    for (const auto & function : *fast())
+    {
+        ASSERT_EQ(flags(function), std::vector<std::string>(2, " fast"));
+        ASSERT_TRUE(function.hasFnAttribute("unsafe-fp-math"));
+    }
+}
+
+TEST(CodeGen, CountedLoops)
+{
+    using namespace mk;
+
+    const auto code = R"CODE(
+        def operator:1(l,r) r
+        def literal() let n = 0 in (for i = 0, i < 9.5, 2 in n = n + i) : n
+        def large() let n = 0 in (for i = 0, i < 3e9 in n = n + 1) : n
+        def runtime(b) let n = 0 in (for i = 0, i < b in n = n + i) : n
+        def fraction() let n = 0 in (for i = 0, i < 9, 0.5 in n = n + i) : n
+        def assigned() for i = 0, i < 9 in i = i + 1
+    )CODE";
+
+    Lexer lexer(code);
+    Parser parser(lexer);
+    const auto & root = parser.parse();
+
+    CodeGen codegen(root, {.ssa = true, .level = OptLevel::O0});
+    const auto module = codegen();
+    ASSERT_TRUE(codegen.errors().empty());
+    ASSERT_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    // Type of the counter of the loop of name, nothing when it counts in
+    // doubles
+    const auto counter = [&](std::string_view name) -> llvm::Type *
+    {
+        for (const auto & block : *module->getFunction(name))
+            for (const auto & instruction : block)
+                if (instruction.getName() == "counter")
+                    return instruction.getType();
+        return nullptr;
+    };
+
+    auto & context = module->getContext();
+    ASSERT_EQ(counter("literal"), llvm::Type::getInt32Ty(context));
+    ASSERT_EQ(counter("large"), llvm::Type::getInt64Ty(context));
+    ASSERT_EQ(counter("runtime"), llvm::Type::getInt32Ty(context));
+    ASSERT_EQ(counter("fraction"), nullptr);
+    ASSERT_EQ(counter("assigned"), nullptr);
+}
+
 TEST(driver, execute)
 {
     const std::string code = R"CODE(
@@ -504,6 +1785,151 @@ TEST(driver, execute)
                driver(code, mk::Driver::Execute{}));
 }
 
+TEST(driver, options)
+{
+    using namespace mk;
+
+    const std::string code = R"CODE(
+        def operator:1(l,r) r
+        def fib(n) if (n < 2) then n else fib(n - 1) + fib(n - 2)
+        def sum(n)
+            let s = 0 in (for i = 0, i < n in s = s + fib(i) * 2) : s
+        def main()
+            sum(10)
+    )CODE";
+
+    // Every level and storage of variables computes the same
+    for (const auto level : {OptLevel::O0,
+                             OptLevel::O1,
+                             OptLevel::O2,
+                             OptLevel::O3,
+                             OptLevel::Os,
+                             OptLevel::Oz})
+        for (const auto ssa : {false, true})
+            std::visit(
+                util::Overload([](int32_t x) { ASSERT_EQ(x, 2 * 143); },
+                               [](...) { FAIL(); }),
+                Driver({.level = level, .ssa = ssa})(code, Driver::Execute{}));
+
+    for (const auto internalize : {false, true})
+        std::visit(util::Overload([](int32_t x) { ASSERT_EQ(x, 2 * 143); },
+                                  [](...) { FAIL(); }),
+                   Driver({.ipo = CodeGen::IPO{.internalize = internalize}})(
+                       code, Driver::Execute{}));
+
+    // Exact on small integers however it is reassociated
+    std::visit(util::Overload([](int32_t x) { ASSERT_EQ(x, 2 * 143); },
+                              [](...) { FAIL(); }),
+               Driver({.level = OptLevel::O3, .math = ast::FastMath::fast})(
+                   code, Driver::Execute{}));
+}
+
+TEST(driver, loops)
+{
+    using namespace mk;
+
+    // Loops counted in integers against the same loops over doubles, the
+    // second of each pair, whose step is not a literal
+    const std::string code = R"CODE(
+        def operator:1(l,r) r
+        def differ(a b) (a < b) + (b < a)
+        def literal() let n = 0 in (for i = 0, i < 9.5, 2 in n = n + i) : n
+        def counted(b) let n = 0 in (for i = 0, i < b in n = n * 2 + i) : n
+        def counted2(b s)
+            let n = 0 in (for i = 0, i < b, s in n = n * 2 + i) : n
+        def nested(b)
+            let n = 0 in (for i = 0, i < b in for j = 1, j < i in n = n + j) : n
+        def nested2(b s)
+            let n = 0 in
+                (for i = 0, i < b in for j = 1, j < i, s in n = n + j) : n
+        def high(b)
+            let n = 0 in (for i = 2147483640, i < b in n = n + i) : n
+        def high2(b s)
+            let n = 0 in (for i = 2147483640, i < b, s in n = n + i) : n
+        def check(b)
+            differ(counted(b), counted2(b, 1))
+            + differ(nested(b), nested2(b, 1))
+        def main()
+            100 * (check(9.5) + check(20) + check(0 - 2) + check(0 - 1e300)
+                   + differ(high(2147483650), high2(2147483650, 1)))
+            + literal()
+    )CODE";
+
+    for (const auto level : {OptLevel::O0, OptLevel::O1, OptLevel::O3})
+        for (const auto ssa : {false, true})
+            std::visit(
+                util::Overload([](int32_t x) { ASSERT_EQ(x, 30); },
+                               [](...) { FAIL(); }),
+                Driver({.level = level, .ssa = ssa})(code, Driver::Execute{}));
+}
+
+TEST(driver, file)
+{
+    using namespace mk;
+
+    const auto path = testing::TempDir() + "file.k";
+    {
+        std::ofstream file(path);
+        file << R"CODE(
+            # Mapped straight from disk
+            def main() 1 + 2 * 3
+        )CODE";
+    }
+
+    Driver driver;
+
+    // main returns an int32_t like the one of a string source
+    const auto result = driver(Driver::File{path}, Driver::Execute{});
+    ASSERT_TRUE(std::holds_alternative<int32_t>(result));
+    ASSERT_EQ(std::get<int32_t>(result), 7);
+
+    std::ofstream(path, std::ios::trunc);
+    std::visit(util::Overload([](std::monostate) {}, [](...) { FAIL(); }),
+               driver(Driver::File{path}, Driver::Execute{}));
+
+    ASSERT_THROW(driver(Driver::File{path + ".missing"}, Driver::Execute{}),
+                 std::system_error);
+
+    // Too large for the offsets of a token stream, the file is sparse and is
+    // rejected before it is read
+    std::filesystem::resize_file(path, std::uintmax_t(1) << 32);
+    ASSERT_THROW(driver(Driver::File{path}, Driver::Execute{}),
+                 std::length_error);
+    std::filesystem::remove(path);
+}
+
+TEST(driver, cache)
+{
+    using namespace mk;
+
+    const auto path = testing::TempDir() + "cache.k";
+    std::filesystem::remove(path + ".ast");
+    std::ofstream(path) << "def main() 1 + 2 * 3";
+
+    Driver driver;
+    const auto run = [&](double expected)
+    {
+        std::visit(util::Overload([&](double x) { ASSERT_EQ(x, expected); },
+                                  [](...) { FAIL(); }),
+                   driver(Driver::File{path, true}, Driver::Execute{}));
+    };
+
+    run(7);
+    ASSERT_TRUE(std::filesystem::exists(path + ".ast"));
+    const auto written = std::filesystem::last_write_time(path + ".ast");
+    run(7);
+    ASSERT_EQ(written, std::filesystem::last_write_time(path + ".ast"));
+
+    // A stale cache is replaced
+    std::ofstream(path) << "def main() (1 + 2) * 3";
+    run(9);
+
+    // So is a broken one
+    std::ofstream(path + ".ast") << "KAST";
+    run(9);
+    run(9);
+}
+
 TEST(driver, link)
 {
     using namespace std::literals;